@@ -0,0 +1,313 @@
+#include "asset_pack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+static u64 alignUp(u64 v) {
+	return (v + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+bool MappedFile::open(const std::string& fileName) {
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view) {
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_file = file;
+	m_mapping = mapping;
+	m_data = static_cast<const u8*>(view);
+	m_size = u64(size.QuadPart);
+#else
+	const int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) return false;
+
+	m_data = static_cast<const u8*>(view);
+	m_size = u64(st.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::close() {
+	if (!m_data) return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+	m_file = m_mapping = nullptr;
+#else
+	munmap(const_cast<u8*>(m_data), size_t(m_size));
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+bool AssetPack::write(
+	const std::string& fileName, const TextureCache& textures,
+	const std::vector<std::unique_ptr<Model>>& models, const std::vector<std::vector<Vec3>>& sectors
+) {
+	PackHeader header{};
+	header.magic = PACK_MAGIC;
+	header.version = PACK_VERSION;
+
+	// Every loaded handle becomes a name, handles sharing texels share a packed texture
+	std::vector<const Texture*> unique;
+	std::vector<PackName> names;
+	std::vector<u32> nameOf(textures.size(), noTexture);
+	for (TextureHandle h = 0; h < textures.size(); h++) {
+		const TextureCache::Source& src = textures.source(h);
+		const Texture& tex = textures.get(h);
+		if (src.fileName.empty() || tex.empty()) continue;
+		if (src.fileName.size() >= sizeof(PackName::fileName)) {
+			std::cerr << "Texture name too long for the pack: " << src.fileName << std::endl;
+			return false;
+		}
+
+		auto it = std::find(unique.begin(), unique.end(), &tex);
+		if (it == unique.end()) it = unique.insert(unique.end(), &tex);
+
+		PackName name{};
+		std::strncpy(name.fileName, src.fileName.c_str(), sizeof(name.fileName) - 1);
+		name.layout = u32(src.layout);
+		name.texture = u32(it - unique.begin());
+		nameOf[h] = u32(names.size());
+		names.push_back(name);
+	}
+
+	std::vector<PackModel> packModels;
+	std::vector<PackVertex> vertices;
+	std::vector<u32> indices;
+	for (auto&& model : models) {
+		PackModel pm{};
+		pm.x = model->position.x;
+		pm.y = model->position.y;
+		pm.rotation = model->rotation;
+		pm.name = model->texture < nameOf.size() ? nameOf[model->texture] : noTexture;
+		pm.firstVertex = u32(vertices.size());
+		pm.vertexCount = u32(model->vertices.size());
+		pm.firstIndex = u32(indices.size());
+		pm.indexCount = u32(model->indices.size());
+		for (auto&& v : model->vertices) {
+			vertices.push_back(PackVertex{ v.pos.x, v.pos.y, v.u });
+		}
+		indices.insert(indices.end(), model->indices.begin(), model->indices.end());
+		packModels.push_back(pm);
+	}
+
+	std::vector<PackSector> packSectors;
+	std::vector<PackPoint> points;
+	for (auto&& polygon : sectors) {
+		packSectors.push_back(PackSector{ u32(points.size()), u32(polygon.size()) });
+		for (auto&& p : polygon) {
+			points.push_back(PackPoint{ p.x, p.y });
+		}
+	}
+
+	// Lay the sections out, each one aligned
+	u64 offset = alignUp(sizeof(PackHeader));
+	auto reserve = [&](u64 bytes) {
+		const u32 at = u32(offset);
+		offset = alignUp(offset + bytes);
+		return at;
+	};
+
+	std::vector<PackTexture> packTextures;
+	header.textureCount = u32(unique.size());
+	header.nameCount = u32(names.size());
+	header.modelCount = u32(packModels.size());
+	header.vertexCount = u32(vertices.size());
+	header.indexCount = u32(indices.size());
+	header.sectorCount = u32(packSectors.size());
+	header.pointCount = u32(points.size());
+	header.textures = reserve(unique.size() * sizeof(PackTexture));
+	header.names = reserve(names.size() * sizeof(PackName));
+	header.models = reserve(packModels.size() * sizeof(PackModel));
+	header.vertices = reserve(vertices.size() * sizeof(PackVertex));
+	header.indices = reserve(indices.size() * sizeof(u32));
+	header.sectors = reserve(packSectors.size() * sizeof(PackSector));
+	header.points = reserve(points.size() * sizeof(PackPoint));
+	for (const Texture* tex : unique) {
+		PackTexture pt{ tex->width(), tex->height(), u32(tex->layout()), 0, tex->texelCount() };
+		pt.texels = reserve(u64(pt.count) * sizeof(u32));
+		packTextures.push_back(pt);
+	}
+	if (offset > 0xFFFFFFFFull) {
+		std::cerr << "Asset pack over 4 GiB: " << fileName << std::endl;
+		return false;
+	}
+	header.fileSize = u32(offset);
+
+	std::vector<u8> buffer(header.fileSize, 0);
+	auto copy = [&](u32 at, const void* src, u64 bytes) {
+		if (bytes) std::memcpy(&buffer[at], src, size_t(bytes));
+	};
+	copy(0, &header, sizeof(header));
+	copy(header.textures, packTextures.data(), packTextures.size() * sizeof(PackTexture));
+	copy(header.names, names.data(), names.size() * sizeof(PackName));
+	copy(header.models, packModels.data(), packModels.size() * sizeof(PackModel));
+	copy(header.vertices, vertices.data(), vertices.size() * sizeof(PackVertex));
+	copy(header.indices, indices.data(), indices.size() * sizeof(u32));
+	copy(header.sectors, packSectors.data(), packSectors.size() * sizeof(PackSector));
+	copy(header.points, points.data(), points.size() * sizeof(PackPoint));
+	for (u32 i = 0; i < unique.size(); i++) {
+		copy(packTextures[i].texels, unique[i]->data(), u64(packTextures[i].count) * sizeof(u32));
+	}
+
+	std::ofstream out(fileName, std::ios::binary);
+	if (!out) return false;
+	out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	return bool(out);
+}
+
+bool AssetPack::open(const std::string& fileName) {
+	close();
+	if (!m_file.open(fileName) || m_file.size() < sizeof(PackHeader)) {
+		m_file.close();
+		return false;
+	}
+
+	const PackHeader* h = table<PackHeader>(0);
+	const u64 size = m_file.size();
+	auto inside = [&](u32 offset, u64 count, u64 stride) {
+		return offset % 4 == 0 && offset + count * stride <= size;
+	};
+
+	bool ok = h->magic == PACK_MAGIC && h->version == PACK_VERSION && h->fileSize == size &&
+		inside(h->textures, h->textureCount, sizeof(PackTexture)) &&
+		inside(h->names, h->nameCount, sizeof(PackName)) &&
+		inside(h->models, h->modelCount, sizeof(PackModel)) &&
+		inside(h->vertices, h->vertexCount, sizeof(PackVertex)) &&
+		inside(h->indices, h->indexCount, sizeof(u32)) &&
+		inside(h->sectors, h->sectorCount, sizeof(PackSector)) &&
+		inside(h->points, h->pointCount, sizeof(PackPoint));
+
+	for (u32 i = 0; ok && i < h->textureCount; i++) {
+		const PackTexture& t = table<PackTexture>(h->textures)[i];
+		ok = t.layout <= u32(TextureLayout::Morton) && t.texels % PACK_ALIGN == 0 && inside(t.texels, t.count, sizeof(u32));
+	}
+	for (u32 i = 0; ok && i < h->nameCount; i++) {
+		const PackName& n = table<PackName>(h->names)[i];
+		ok = n.layout <= u32(TextureLayout::Morton) && n.texture < h->textureCount && std::memchr(n.fileName, 0, sizeof(n.fileName)) != nullptr;
+	}
+	const u32* indices = table<u32>(h->indices);
+	for (u32 i = 0; ok && i < h->modelCount; i++) {
+		const PackModel& m = table<PackModel>(h->models)[i];
+		ok = (m.name == noTexture || m.name < h->nameCount) &&
+			u64(m.firstVertex) + m.vertexCount <= h->vertexCount &&
+			u64(m.firstIndex) + m.indexCount <= h->indexCount;
+		for (u32 j = 0; ok && j < m.indexCount; j++) {
+			ok = indices[m.firstIndex + j] < m.vertexCount;
+		}
+	}
+	for (u32 i = 0; ok && i < h->sectorCount; i++) {
+		const PackSector& s = table<PackSector>(h->sectors)[i];
+		ok = u64(s.firstPoint) + s.pointCount <= h->pointCount;
+	}
+
+	if (!ok) {
+		m_file.close();
+		return false;
+	}
+	m_header = h;
+	return true;
+}
+
+void AssetPack::close() {
+	m_header = nullptr;
+	m_file.close();
+}
+
+std::vector<TextureHandle> AssetPack::mount(TextureCache& cache) const {
+	std::vector<TextureHandle> handles;
+	if (!m_header) return handles;
+
+	std::vector<TextureHandle> textures(m_header->textureCount, noTexture);
+	for (u32 i = 0; i < m_header->nameCount; i++) {
+		const PackName& name = table<PackName>(m_header->names)[i];
+		const TextureLayout layout = TextureLayout(name.layout);
+		TextureHandle& handle = textures[name.texture];
+
+		if (handle == noTexture) {
+			const PackTexture& t = table<PackTexture>(m_header->textures)[name.texture];
+			Texture view = Texture::view(t.width, t.height, TextureLayout(t.layout), table<u32>(t.texels), t.count);
+			if (!view.empty()) handle = cache.insert(name.fileName, layout, std::move(view));
+		} else {
+			cache.alias(name.fileName, layout, handle);
+		}
+		handles.push_back(handle);
+	}
+	return handles;
+}
+
+void AssetPack::models(const std::vector<TextureHandle>& handles, std::vector<std::unique_ptr<Model>>& models) const {
+	if (!m_header) return;
+
+	const PackVertex* vertices = table<PackVertex>(m_header->vertices);
+	const u32* indices = table<u32>(m_header->indices);
+	for (u32 i = 0; i < m_header->modelCount; i++) {
+		const PackModel& pm = table<PackModel>(m_header->models)[i];
+
+		Model* model = new Model();
+		model->position = Vec3(pm.x, pm.y, 0.0f);
+		model->rotation = pm.rotation;
+		model->texture = pm.name < handles.size() ? handles[pm.name] : noTexture;
+		for (u32 v = 0; v < pm.vertexCount; v++) {
+			const PackVertex& pv = vertices[pm.firstVertex + v];
+			model->addVert(Vec3(pv.x, pv.y, 0.0f), pv.u);
+		}
+		for (u32 j = 0; j < pm.indexCount; j++) {
+			model->addIndex(indices[pm.firstIndex + j]);
+		}
+		models.push_back(std::unique_ptr<Model>(model));
+	}
+}
+
+void AssetPack::sectors(std::vector<std::vector<Vec3>>& sectors) const {
+	if (!m_header) return;
+
+	const PackPoint* points = table<PackPoint>(m_header->points);
+	for (u32 i = 0; i < m_header->sectorCount; i++) {
+		const PackSector& ps = table<PackSector>(m_header->sectors)[i];
+		std::vector<Vec3> polygon;
+		for (u32 p = 0; p < ps.pointCount; p++) {
+			polygon.push_back(Vec3(points[ps.firstPoint + p].x, points[ps.firstPoint + p].y, 0.0f));
+		}
+		sectors.push_back(polygon);
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include "world.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Pre-decoded assets in one little-endian file that is memory-mapped and
+// used in place: textures with all mip levels in their sampling layout,
+// and the level geometry (models and sector polygons, in block units).
+// Every section and texel block starts on a 64 byte boundary.
+//
+// header | textures | names | models | vertices | indices | sectors | points | texels
+
+const u32 PACK_MAGIC = 0x4B504352; // "RCPK"
+const u32 PACK_VERSION = 1;
+const u32 PACK_ALIGN = 64;
+
+struct PackHeader {
+	u32 magic, version, fileSize;
+	u32 textureCount, nameCount, modelCount, vertexCount, indexCount, sectorCount, pointCount;
+	// Byte offsets of the tables
+	u32 textures, names, models, vertices, indices, sectors, points;
+};
+
+// Texels of all mip levels (count), at byte offset texels
+struct PackTexture {
+	u32 width, height, layout, texels, count;
+};
+
+// A file/layout pair as passed to TextureCache::load, resolving to textures[texture]
+struct PackName {
+	char fileName[56];
+	u32 layout, texture;
+};
+
+// Vertices and indices are ranges of the shared tables, name is an index in
+// the name table or noTexture
+struct PackModel {
+	f32 x, y, rotation;
+	u32 name;
+	u32 firstVertex, vertexCount, firstIndex, indexCount;
+};
+
+struct PackVertex {
+	f32 x, y, u;
+};
+
+struct PackSector {
+	u32 firstPoint, pointCount;
+};
+
+struct PackPoint {
+	f32 x, y;
+};
+
+// Read-only view of a file mapped into memory
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator =(const MappedFile&) = delete;
+
+	bool open(const std::string& fileName);
+	void close();
+
+	const u8* data() const { return m_data; }
+	u64 size() const { return m_size; }
+
+private:
+	const u8* m_data{ nullptr };
+	u64 m_size{ 0 };
+#ifdef _WIN32
+	void* m_file{ nullptr };
+	void* m_mapping{ nullptr };
+#endif
+};
+
+class AssetPack {
+public:
+	// Packs every loaded texture of the cache and the given level
+	static bool write(
+		const std::string& fileName, const TextureCache& textures,
+		const std::vector<std::unique_ptr<Model>>& models, const std::vector<std::vector<Vec3>>& sectors
+	);
+
+	// Maps the pack and checks that every table and texel block lies inside it
+	bool open(const std::string& fileName);
+	void close();
+	bool isOpen() const { return m_header != nullptr; }
+
+	// Registers the packed textures under their names, without decoding or copying,
+	// and returns the handle of every name. The pack must stay open while the cache uses them.
+	std::vector<TextureHandle> mount(TextureCache& cache) const;
+
+	// Appends the packed level, handles as returned by mount()
+	void models(const std::vector<TextureHandle>& handles, std::vector<std::unique_ptr<Model>>& models) const;
+	void sectors(std::vector<std::vector<Vec3>>& sectors) const;
+
+	u64 size() const { return m_file.size(); }
+
+private:
+	template <typename T>
+	const T* table(u32 offset) const { return reinterpret_cast<const T*>(m_file.data() + offset); }
+
+	MappedFile m_file;
+	const PackHeader* m_header{ nullptr };
+};
+
+#endif // ASSET_PACK_H
@@ -0,0 +1,334 @@
+#include "bsp.h"
+
+#include "SDL.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Distance below which a point is considered to lie on a splitter
+static const f32 PLANE_EPSILON = 1e-4f;
+// Number of candidate splitters evaluated per node
+static const u32 MAX_CANDIDATES = 32;
+
+enum Side {
+	SideOn = 0,
+	SideFront,
+	SideBack,
+	SideSplit
+};
+
+static inline f32 distance(const BSP::Node& n, const Vec3& p) {
+	return n.normal.dot(p - n.point);
+}
+
+static Side classify(const Vec3& point, const Vec3& normal, const BSP::Fragment& frag, f32& da, f32& db) {
+	da = normal.dot(frag.a - point);
+	db = normal.dot(frag.b - point);
+	const bool aOn = std::fabs(da) <= PLANE_EPSILON, bOn = std::fabs(db) <= PLANE_EPSILON;
+	if (aOn && bOn) return SideOn;
+	if (da >= -PLANE_EPSILON && db >= -PLANE_EPSILON) return SideFront;
+	if (da <= PLANE_EPSILON && db <= PLANE_EPSILON) return SideBack;
+	return SideSplit;
+}
+
+void BSP::clear() {
+	m_nodes.clear();
+	m_fragments.clear();
+	m_lineA.clear();
+	m_lineB.clear();
+	m_stats = Stats{};
+}
+
+void BSP::build(const std::vector<Line>& lines, f32 splitWeight) {
+	u64 start = SDL_GetPerformanceCounter();
+
+	clear();
+
+	std::vector<Fragment> frags;
+	frags.reserve(lines.size());
+	for (u32 i = 0; i < lines.size(); i++) {
+		m_lineA.push_back(lines[i].a);
+		m_lineB.push_back(lines[i].b);
+
+		Fragment frag;
+		frag.a = m_lineA.back();
+		frag.b = m_lineB.back();
+		frag.line = i;
+		frag.s0 = 0.0f;
+		frag.s1 = 1.0f;
+		// Degenerate segments can't define a splitter and can't be hit
+		if ((frag.b - frag.a).length() > PLANE_EPSILON) {
+			frags.push_back(frag);
+		}
+	}
+
+	m_stats.segments = u32(lines.size());
+	buildNode(frags, 1, splitWeight);
+
+	m_stats.nodes = u32(m_nodes.size());
+	m_stats.fragments = u32(m_fragments.size());
+	m_stats.buildMs = f64(SDL_GetPerformanceCounter() - start) * 1000.0 / f64(SDL_GetPerformanceFrequency());
+}
+
+u32 BSP::chooseSplitter(const std::vector<Fragment>& frags, f32 splitWeight) const {
+	const u32 step = std::max(u32(frags.size()) / MAX_CANDIDATES, 1u);
+
+	u32 best = 0;
+	f32 bestScore = std::numeric_limits<f32>::max();
+	for (u32 c = 0; c < frags.size(); c += step) {
+		const Fragment& cand = frags[c];
+		Vec3 dir = cand.b - cand.a;
+		Vec3 normal = Vec3(-dir.y, dir.x, 0.0f).normalized();
+
+		u32 front = 0, back = 0, splits = 0;
+		for (auto&& frag : frags) {
+			f32 da, db;
+			switch (classify(cand.a, normal, frag, da, db)) {
+				case SideFront: front++; break;
+				case SideBack: back++; break;
+				case SideSplit: splits++; break;
+				default: break;
+			}
+		}
+
+		// Few splits first, then balance
+		f32 score = splits * splitWeight + std::fabs(f32(front) - f32(back));
+		if (score < bestScore) {
+			bestScore = score;
+			best = c;
+		}
+	}
+	return best;
+}
+
+i32 BSP::buildNode(std::vector<Fragment>& frags, u32 depth, f32 splitWeight) {
+	if (frags.empty()) return -1;
+
+	m_stats.depth = std::max(m_stats.depth, depth);
+
+	const Fragment& splitter = frags[chooseSplitter(frags, splitWeight)];
+	Vec3 dir = splitter.b - splitter.a;
+
+	Node node;
+	node.point = splitter.a;
+	node.normal = Vec3(-dir.y, dir.x, 0.0f).normalized();
+
+	std::vector<Fragment> front, back;
+	node.first = u32(m_fragments.size());
+	node.count = 0;
+
+	for (auto&& frag : frags) {
+		f32 da, db;
+		switch (classify(node.point, node.normal, frag, da, db)) {
+			case SideOn:
+				m_fragments.push_back(frag);
+				node.count++;
+				break;
+			case SideFront: front.push_back(frag); break;
+			case SideBack: back.push_back(frag); break;
+			case SideSplit: {
+				const f32 s = da / (da - db);
+				const f32 sm = frag.s0 + (frag.s1 - frag.s0) * s;
+				const Vec3 mid = frag.a + (frag.b - frag.a) * s;
+
+				Fragment fa = frag, fb = frag;
+				fa.b = mid;
+				fa.s1 = sm;
+				fb.a = mid;
+				fb.s0 = sm;
+				(da > 0.0f ? front : back).push_back(fa);
+				(db > 0.0f ? front : back).push_back(fb);
+				m_stats.splits++;
+			} break;
+		}
+	}
+
+	// Release the parent's list before going deeper
+	frags.clear();
+	frags.shrink_to_fit();
+
+	const i32 index = i32(m_nodes.size());
+	m_nodes.push_back(node);
+
+	const i32 frontChild = buildNode(front, depth + 1, splitWeight);
+	const i32 backChild = buildNode(back, depth + 1, splitWeight);
+
+	Node& n = m_nodes[index];
+	n.front = frontChild;
+	n.back = backChild;
+
+	n.minX = n.minY = std::numeric_limits<f32>::max();
+	n.maxX = n.maxY = -std::numeric_limits<f32>::max();
+	for (u32 i = n.first; i < n.first + n.count; i++) {
+		const Fragment& frag = m_fragments[i];
+		n.minX = std::min(n.minX, std::min(frag.a.x, frag.b.x));
+		n.minY = std::min(n.minY, std::min(frag.a.y, frag.b.y));
+		n.maxX = std::max(n.maxX, std::max(frag.a.x, frag.b.x));
+		n.maxY = std::max(n.maxY, std::max(frag.a.y, frag.b.y));
+	}
+	for (i32 child : { frontChild, backChild }) {
+		if (child < 0) continue;
+		const Node& c = m_nodes[child];
+		n.minX = std::min(n.minX, c.minX);
+		n.minY = std::min(n.minY, c.minY);
+		n.maxX = std::max(n.maxX, c.maxX);
+		n.maxY = std::max(n.maxY, c.maxY);
+	}
+
+	return index;
+}
+
+bool BSP::hitFragment(const Fragment& frag, const Vec3& o, const Vec3& d, SegmentHit& hit, f32& t) const {
+	// Intersect the source segment so t/u are the same as without the BSP
+	Vec3 hitPos, hitNorm;
+	f32 u;
+	if (!raySeg(o, d, m_lineA[frag.line], m_lineB[frag.line], hitPos, hitNorm, t, u)) return false;
+	if (u < frag.s0 || u > frag.s1) return false;
+
+	hit.index = frag.line;
+	hit.position = hitPos;
+	hit.normal = hitNorm;
+	hit.t = t;
+	hit.u = u;
+	return true;
+}
+
+bool BSP::closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats) const {
+	ClosestHit q(tmax);
+	query(o, d, q, stats);
+	if (q.found) hit = q.hit;
+	return q.found;
+}
+
+template <typename Query>
+void BSP::query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	queryNode(m_nodes.empty() ? -1 : 0, o, d, q, stats);
+}
+
+template <typename Query>
+void BSP::queryNode(i32 node, const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	if (node < 0 || q.done()) return;
+	if (stats) stats->nodes++;
+
+	const Node& n = m_nodes[node];
+	const f32 dist = distance(n, o);
+	const f32 denom = n.normal.dot(d);
+	const i32 nearChild = dist >= 0.0f ? n.front : n.back;
+	const i32 farChild = dist >= 0.0f ? n.back : n.front;
+
+	queryNode(nearChild, o, d, q, stats);
+
+	for (u32 i = n.first; i < n.first + n.count && !q.done(); i++) {
+		SegmentHit h;
+		f32 t;
+		if (stats) stats->tests++;
+		if (hitFragment(m_fragments[i], o, d, h, t)) {
+			q.add(h.index, h.position, h.normal, h.t, h.u);
+		}
+	}
+
+	// The far side can only be reached if the ray crosses the splitter within the query limit
+	if (denom != 0.0f) {
+		const f32 tSplit = -dist / denom;
+		if (tSplit >= 0.0f && tSplit <= q.limit()) {
+			queryNode(farChild, o, d, q, stats);
+		}
+	}
+}
+
+template void BSP::query(const Vec3&, const Vec3&, ClosestHit&, RayStats*) const;
+template void BSP::query(const Vec3&, const Vec3&, AnyHit&, RayStats*) const;
+template void BSP::query(const Vec3&, const Vec3&, SortedHits&, RayStats*) const;
+
+struct BSP::ColumnPass {
+	const ColumnCamera& camera;
+	u32 begin, end;
+	f32 tmax;
+	SegmentHit* hits;
+	u8* found;
+	RayStats* stats;
+	u32 remaining;
+
+	// Whether a node's bounds can still cover an empty column
+	bool visible(const Node& n) const {
+		const Vec3 corners[4] = {
+			Vec3(n.minX, n.minY, 0.0f), Vec3(n.maxX, n.minY, 0.0f),
+			Vec3(n.minX, n.maxY, 0.0f), Vec3(n.maxX, n.maxY, 0.0f)
+		};
+
+		f32 lo = std::numeric_limits<f32>::max(), hi = -lo;
+		u32 behind = 0;
+		for (auto&& c : corners) {
+			Vec3 v = c - camera.origin;
+			f32 alpha = v.dot(camera.forward);
+			if (alpha < ColumnCamera::nearEpsilon) {
+				behind++;
+				continue;
+			}
+			f32 x = camera.column(v, alpha);
+			lo = std::min(lo, x);
+			hi = std::max(hi, x);
+		}
+
+		if (behind == 4) return false;
+		// Partly behind the viewer: the projection is unbounded on one side
+		if (behind > 0) return true;
+
+		u32 x0 = u32(std::max(std::floor(lo) - 1.0f, f32(begin)));
+		u32 x1 = u32(std::max(std::min(std::ceil(hi) + 2.0f, f32(end)), f32(begin)));
+		for (u32 x = x0; x < x1; x++) {
+			if (!found[x]) return true;
+		}
+		return false;
+	}
+};
+
+void BSP::trace(
+	const ColumnCamera& camera, u32 begin, u32 end, f32 tmax,
+	SegmentHit* hits, u8* found, RayStats* stats) const
+{
+	std::fill(found + begin, found + end, u8(0));
+
+	ColumnPass pass{ camera, begin, end, tmax, hits, found, stats, end - begin };
+	if (!m_nodes.empty()) {
+		traceNode(0, pass);
+	}
+}
+
+void BSP::traceNode(i32 node, ColumnPass& pass) const {
+	if (node < 0 || pass.remaining == 0) return;
+	if (pass.stats) pass.stats->nodes++;
+
+	const Node& n = m_nodes[node];
+	if (!pass.visible(n)) return;
+
+	const bool front = distance(n, pass.camera.origin) >= 0.0f;
+	traceNode(front ? n.front : n.back, pass);
+
+	for (u32 i = n.first; i < n.first + n.count && pass.remaining > 0; i++) {
+		const Fragment& frag = m_fragments[i];
+		u32 x0, x1;
+		if (!pass.camera.columns(frag.a, frag.b, pass.begin, pass.end, x0, x1)) continue;
+
+		for (u32 x = x0; x < x1; x++) {
+			if (pass.found[x]) continue;
+
+			SegmentHit hit;
+			f32 t;
+			if (pass.stats) pass.stats->tests++;
+			if (hitFragment(frag, pass.camera.origin, pass.camera.ray(x), hit, t)) {
+				// The first hit is the closest one, if it's too far the column stays empty
+				if (t < pass.tmax) {
+					pass.hits[x] = hit;
+					pass.found[x] = 1;
+				} else {
+					pass.found[x] = 2;
+				}
+				pass.remaining--;
+			}
+		}
+	}
+
+	traceNode(front ? n.back : n.front, pass);
+}
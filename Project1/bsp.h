@@ -0,0 +1,74 @@
+#ifndef BSP_H
+#define BSP_H
+
+#include "world.h"
+#include "segment_query.h"
+
+#include <vector>
+
+// Doom-style BSP tree over static world-space segments (the splitters
+// depend on the geometry, so moving segments means a rebuild).
+// Segments are cut into fragments by the splitter lines; a fragment keeps
+// its source line and the [s0, s1] range it covers on it, so hits are still
+// computed against the original segment and give the same t/u.
+// Walking the tree from the viewer yields fragments front to back, which
+// lets the column renderer stop once every column has been covered.
+class BSP {
+public:
+	struct Fragment {
+		Vec3 a, b; // fragment end points
+		u32 line;
+		f32 s0, s1;
+	};
+
+	struct Node {
+		Vec3 point, normal; // splitter line
+		f32 minX, minY, maxX, maxY; // bounds of the whole subtree
+		u32 first, count; // fragments lying on the splitter
+		i32 front, back; // child nodes, -1 if empty
+	};
+
+	struct Stats {
+		u32 nodes, fragments, splits, depth, segments;
+		f64 buildMs;
+	};
+
+	// splitWeight is the cost of one split relative to one segment of imbalance
+	void build(const std::vector<Line>& lines, f32 splitWeight = 8.0f);
+	void clear();
+
+	// Closest hit along one ray with t < tmax
+	bool closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats = nullptr) const;
+
+	// Feeds the hits along a ray to a ClosestHit, AnyHit or SortedHits query
+	template <typename Query>
+	void query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats = nullptr) const;
+
+	// Front-to-back column pass over [begin, end). Fills hits[x]/found[x]
+	// (indexed by screen column) and stops once every column is resolved:
+	// found[x] is 1 for a hit, 2 when the nearest segment is beyond tmax.
+	void trace(
+		const ColumnCamera& camera, u32 begin, u32 end, f32 tmax,
+		SegmentHit* hits, u8* found, RayStats* stats = nullptr
+	) const;
+
+	const Stats& stats() const { return m_stats; }
+	bool empty() const { return m_nodes.empty(); }
+
+private:
+	struct ColumnPass;
+
+	i32 buildNode(std::vector<Fragment>& frags, u32 depth, f32 splitWeight);
+	u32 chooseSplitter(const std::vector<Fragment>& frags, f32 splitWeight) const;
+	bool hitFragment(const Fragment& frag, const Vec3& o, const Vec3& d, SegmentHit& hit, f32& t) const;
+	template <typename Query>
+	void queryNode(i32 node, const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const;
+	void traceNode(i32 node, ColumnPass& pass) const;
+
+	std::vector<Node> m_nodes;
+	std::vector<Fragment> m_fragments; // grouped by node
+	std::vector<Vec3> m_lineA, m_lineB; // source segments
+	Stats m_stats{};
+};
+
+#endif // BSP_H
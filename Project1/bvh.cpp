@@ -0,0 +1,493 @@
+#include "bvh.h"
+#include "simd.h"
+
+#include "SDL.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <limits>
+
+static const u32 MAX_LEAF_SIZE = 4;
+static const u32 SAH_BINS = 8;
+// Traversal stack size; a node at depth k has at most k - 1 entries pushed
+// above it, so subdivide() stops at this depth and the stacks never overflow
+static const u32 MAX_STACK = 64;
+// Boxes are padded so hits right on a box edge are never culled
+static const f32 BOX_PADDING = 1e-3f;
+// A packet with at most 1/4 of its lanes still active traces them one by one
+static const u32 PACKET_FALLBACK_DIVISOR = 4;
+
+void BVH::build(const std::vector<Line>& lines) {
+	u64 start = SDL_GetPerformanceCounter();
+
+	m_nodes.clear();
+	m_segments.clear();
+	m_centroids.clear();
+	m_stats = Stats{};
+
+	m_segments.reserve(lines.size());
+	m_centroids.reserve(lines.size());
+	for (u32 i = 0; i < lines.size(); i++) {
+		Segment seg;
+		seg.a = lines[i].a;
+		seg.b = lines[i].b;
+		seg.line = i;
+		m_segments.push_back(seg);
+		m_centroids.push_back((seg.a + seg.b) * 0.5f);
+	}
+
+	if (!m_segments.empty()) {
+		m_nodes.reserve(m_segments.size() * 2);
+		m_nodes.push_back(Node{});
+		m_stats.depth = subdivide(0, 0, u32(m_segments.size()), 1);
+	}
+
+	// Where every line ended up, for refits
+	m_slots.assign(m_segments.size(), 0);
+	m_leaves.assign(m_segments.size(), 0);
+	for (u32 n = 0; n < m_nodes.size(); n++) {
+		const Node& node = m_nodes[n];
+		for (u32 i = node.first; node.count > 0 && i < node.first + node.count; i++) {
+			m_slots[m_segments[i].line] = i;
+			m_leaves[i] = n;
+		}
+	}
+
+	m_stats.nodes = u32(m_nodes.size());
+	m_stats.segments = u32(m_segments.size());
+	m_stats.buildMs = f64(SDL_GetPerformanceCounter() - start) * 1000.0 / f64(SDL_GetPerformanceFrequency());
+}
+
+void BVH::refit(const std::vector<Line>& lines, const std::vector<u32>& changed) {
+	if (changed.empty()) return;
+
+	std::vector<u8> dirty(m_nodes.size(), 0);
+	for (u32 l : changed) {
+		Segment& seg = m_segments[m_slots[l]];
+		seg.a = lines[l].a;
+		seg.b = lines[l].b;
+		m_centroids[m_slots[l]] = (seg.a + seg.b) * 0.5f;
+		dirty[m_leaves[m_slots[l]]] = 1;
+	}
+
+	// Children always come after their parent, so a reverse sweep is bottom-up
+	for (u32 n = u32(m_nodes.size()); n-- > 0;) {
+		Node& node = m_nodes[n];
+		if (node.count > 0) {
+			if (dirty[n]) bounds(node.first, node.count, node);
+			continue;
+		}
+
+		const Node& l = m_nodes[node.first];
+		const Node& r = m_nodes[node.first + 1];
+		if (!dirty[node.first] && !dirty[node.first + 1]) continue;
+		node.minX = std::min(l.minX, r.minX);
+		node.minY = std::min(l.minY, r.minY);
+		node.maxX = std::max(l.maxX, r.maxX);
+		node.maxY = std::max(l.maxY, r.maxY);
+		dirty[n] = 1;
+	}
+}
+
+void BVH::bounds(u32 first, u32 count, Node& node) const {
+	node.minX = node.minY = std::numeric_limits<f32>::max();
+	node.maxX = node.maxY = -std::numeric_limits<f32>::max();
+	for (u32 i = first; i < first + count; i++) {
+		const Segment& seg = m_segments[i];
+		node.minX = std::min(node.minX, std::min(seg.a.x, seg.b.x));
+		node.minY = std::min(node.minY, std::min(seg.a.y, seg.b.y));
+		node.maxX = std::max(node.maxX, std::max(seg.a.x, seg.b.x));
+		node.maxY = std::max(node.maxY, std::max(seg.a.y, seg.b.y));
+	}
+	node.minX -= BOX_PADDING;
+	node.minY -= BOX_PADDING;
+	node.maxX += BOX_PADDING;
+	node.maxY += BOX_PADDING;
+}
+
+u32 BVH::subdivide(u32 node, u32 first, u32 count, u32 depth) {
+	bounds(first, count, m_nodes[node]);
+	m_nodes[node].first = first;
+	m_nodes[node].count = count;
+
+	// Past the stack depth the range stays one (larger) leaf
+	if (count <= MAX_LEAF_SIZE || depth >= MAX_STACK) {
+		m_stats.leaves++;
+		return depth;
+	}
+
+	// Centroid bounds
+	f32 cmin[2] = { std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max() };
+	f32 cmax[2] = { -std::numeric_limits<f32>::max(), -std::numeric_limits<f32>::max() };
+	for (u32 i = first; i < first + count; i++) {
+		const Vec3& c = m_centroids[i];
+		cmin[0] = std::min(cmin[0], c.x); cmax[0] = std::max(cmax[0], c.x);
+		cmin[1] = std::min(cmin[1], c.y); cmax[1] = std::max(cmax[1], c.y);
+	}
+
+	// Binned SAH. In 2D the chance of a random line crossing a box is
+	// proportional to its perimeter, so half-perimeters stand in for areas.
+	struct Bin {
+		f32 minX, minY, maxX, maxY;
+		u32 count;
+	};
+
+	f32 bestCost = std::numeric_limits<f32>::max();
+	i32 bestAxis = -1;
+	f32 bestSplit = 0.0f;
+
+	for (u32 axis = 0; axis < 2; axis++) {
+		f32 extent = cmax[axis] - cmin[axis];
+		if (extent <= 0.0f) continue;
+
+		Bin bins[SAH_BINS];
+		for (auto&& bin : bins) {
+			bin.minX = bin.minY = std::numeric_limits<f32>::max();
+			bin.maxX = bin.maxY = -std::numeric_limits<f32>::max();
+			bin.count = 0;
+		}
+
+		const f32 binScale = SAH_BINS / extent;
+		for (u32 i = first; i < first + count; i++) {
+			f32 c = axis == 0 ? m_centroids[i].x : m_centroids[i].y;
+			u32 b = std::min(u32((c - cmin[axis]) * binScale), SAH_BINS - 1);
+			const Segment& seg = m_segments[i];
+			Bin& bin = bins[b];
+			bin.minX = std::min(bin.minX, std::min(seg.a.x, seg.b.x));
+			bin.minY = std::min(bin.minY, std::min(seg.a.y, seg.b.y));
+			bin.maxX = std::max(bin.maxX, std::max(seg.a.x, seg.b.x));
+			bin.maxY = std::max(bin.maxY, std::max(seg.a.y, seg.b.y));
+			bin.count++;
+		}
+
+		auto grow = [](Bin& acc, const Bin& b) {
+			if (b.count == 0) return;
+			acc.minX = std::min(acc.minX, b.minX);
+			acc.minY = std::min(acc.minY, b.minY);
+			acc.maxX = std::max(acc.maxX, b.maxX);
+			acc.maxY = std::max(acc.maxY, b.maxY);
+			acc.count += b.count;
+		};
+		auto halfPerimeter = [](const Bin& b) {
+			return b.count == 0 ? 0.0f : (b.maxX - b.minX) + (b.maxY - b.minY);
+		};
+
+		// Sweep from the right to get the right-hand cost of every plane
+		f32 rightCost[SAH_BINS];
+		Bin acc = bins[SAH_BINS - 1];
+		acc.count = 0;
+		acc.minX = acc.minY = std::numeric_limits<f32>::max();
+		acc.maxX = acc.maxY = -std::numeric_limits<f32>::max();
+		for (u32 b = SAH_BINS - 1; b > 0; b--) {
+			grow(acc, bins[b]);
+			rightCost[b] = halfPerimeter(acc) * acc.count;
+		}
+
+		acc.count = 0;
+		acc.minX = acc.minY = std::numeric_limits<f32>::max();
+		acc.maxX = acc.maxY = -std::numeric_limits<f32>::max();
+		for (u32 b = 0; b < SAH_BINS - 1; b++) {
+			grow(acc, bins[b]);
+			f32 cost = halfPerimeter(acc) * acc.count + rightCost[b + 1];
+			if (acc.count > 0 && acc.count < count && cost < bestCost) {
+				bestCost = cost;
+				bestAxis = i32(axis);
+				bestSplit = cmin[axis] + extent * f32(b + 1) / SAH_BINS;
+			}
+		}
+	}
+
+	const Node& n = m_nodes[node];
+	f32 leafCost = ((n.maxX - n.minX) + (n.maxY - n.minY)) * count;
+
+	u32 mid = first;
+	if (bestAxis >= 0) {
+		if (bestCost >= leafCost && count <= MAX_LEAF_SIZE * 2) {
+			m_stats.leaves++;
+			return depth;
+		}
+
+		// Partition segments (and their centroids) around the split plane
+		u32 i = first, j = first + count;
+		while (i < j) {
+			f32 c = bestAxis == 0 ? m_centroids[i].x : m_centroids[i].y;
+			if (c < bestSplit) {
+				i++;
+			} else {
+				j--;
+				std::swap(m_segments[i], m_segments[j]);
+				std::swap(m_centroids[i], m_centroids[j]);
+			}
+		}
+		mid = i;
+	}
+
+	// All centroids coincide, or the split was one-sided: halve the range
+	if (mid == first || mid == first + count) {
+		mid = first + count / 2;
+	}
+
+	u32 left = u32(m_nodes.size());
+	m_nodes.push_back(Node{});
+	m_nodes.push_back(Node{});
+	m_nodes[node].first = left;
+	m_nodes[node].count = 0;
+
+	u32 dl = subdivide(left, first, mid - first, depth + 1);
+	u32 dr = subdivide(left + 1, mid, first + count - mid, depth + 1);
+	return std::max(dl, dr);
+}
+
+// Ray vs box, returns the entry distance or infinity on a miss.
+// Boxes entered exactly at tmax are kept so ties resolve like brute force.
+static inline f32 slab(const BVH::Node& n, const Vec3& o, f32 invX, f32 invY, f32 tmax) {
+	f32 tx1 = (n.minX - o.x) * invX, tx2 = (n.maxX - o.x) * invX;
+	f32 ty1 = (n.minY - o.y) * invY, ty2 = (n.maxY - o.y) * invY;
+	f32 tnear = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), 0.0f);
+	f32 tfar = std::min(std::max(tx1, tx2), std::max(ty1, ty2));
+	if (tnear <= tfar && tnear <= tmax) return tnear;
+	return std::numeric_limits<f32>::infinity();
+}
+
+bool BVH::closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats) const {
+	ClosestHit q(tmax);
+	query(o, d, q, stats);
+	if (q.found) hit = q.hit;
+	return q.found;
+}
+
+template <typename Query>
+void BVH::query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	if (!m_nodes.empty()) queryNode(0, o, d, q, stats);
+}
+
+template <typename Query>
+void BVH::queryNode(u32 root, const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	const f32 invX = 1.0f / d.x, invY = 1.0f / d.y;
+	const f32 inf = std::numeric_limits<f32>::infinity();
+
+	u32 stack[MAX_STACK];
+	u32 sp = 0;
+	u32 node = root;
+
+	if (slab(m_nodes[root], o, invX, invY, q.limit()) == inf) {
+		if (stats) stats->nodes++;
+		return;
+	}
+
+	while (true) {
+		if (stats) stats->nodes++;
+		const Node& n = m_nodes[node];
+
+		if (n.count > 0) {
+			for (u32 i = n.first; i < n.first + n.count; i++) {
+				const Segment& seg = m_segments[i];
+				querySegment(q, seg.line, o, d, seg.a, seg.b, stats);
+			}
+			if (q.done()) return;
+		} else {
+			u32 c0 = n.first, c1 = n.first + 1;
+			f32 d0 = slab(m_nodes[c0], o, invX, invY, q.limit());
+			f32 d1 = slab(m_nodes[c1], o, invX, invY, q.limit());
+			if (d1 < d0) {
+				std::swap(c0, c1);
+				std::swap(d0, d1);
+			}
+
+			if (d0 != inf) {
+				if (d1 != inf) {
+					assert(sp < MAX_STACK);
+					stack[sp++] = c1;
+				}
+				node = c0;
+				continue;
+			}
+		}
+
+		// Pop, skipping nodes that are now further than the query limit
+		bool next = false;
+		while (sp > 0) {
+			node = stack[--sp];
+			if (slab(m_nodes[node], o, invX, invY, q.limit()) != inf) {
+				next = true;
+				break;
+			}
+		}
+		if (!next) break;
+	}
+}
+
+template void BVH::query(const Vec3&, const Vec3&, ClosestHit&, RayStats*) const;
+template void BVH::query(const Vec3&, const Vec3&, AnyHit&, RayStats*) const;
+template void BVH::query(const Vec3&, const Vec3&, SortedHits&, RayStats*) const;
+
+struct BVH::Packet {
+	const RayPacket& rays;
+	f32 v3x[RayPacket::maxSize]; // -dy, as raySeg's v3
+	f32 invX[RayPacket::maxSize], invY[RayPacket::maxSize];
+	ClosestHit q[RayPacket::maxSize];
+
+	Packet(const RayPacket& rays, f32 tmax) : rays(rays) {
+		for (u32 i = 0; i < RayPacket::maxSize; i++) {
+			v3x[i] = -rays.dy[i];
+			invX[i] = 1.0f / rays.dx[i];
+			invY[i] = 1.0f / rays.dy[i];
+			q[i] = ClosestHit(tmax);
+		}
+	}
+
+	Vec3 ray(u32 lane) const { return Vec3(rays.dx[lane], rays.dy[lane], 0.0f); }
+
+	// Lanes of mask whose ray enters the node within its limit, and the
+	// nearest entry distance among them
+	u32 slab(const Node& n, u32 mask, f32& tnear) const {
+		const Vec3& o = rays.origin;
+		u32 hit = 0;
+		tnear = std::numeric_limits<f32>::infinity();
+#if defined(SIMD_SSE)
+		// Same operations as ::slab(), std::min(a, b) is _mm_min_ps(b, a)
+		// and std::max(a, b) is _mm_max_ps(b, a) including NaN handling
+		const __m128 minX = _mm_set1_ps(n.minX - o.x), maxX = _mm_set1_ps(n.maxX - o.x);
+		const __m128 minY = _mm_set1_ps(n.minY - o.y), maxY = _mm_set1_ps(n.maxY - o.y);
+		const __m128 zero = _mm_setzero_ps();
+		alignas(16) f32 nears[4];
+		for (u32 base = 0; base < rays.size; base += 4) {
+			if (((mask >> base) & 0xF) == 0) continue;
+			const __m128 ix = _mm_loadu_ps(&invX[base]), iy = _mm_loadu_ps(&invY[base]);
+			const __m128 tx1 = _mm_mul_ps(minX, ix), tx2 = _mm_mul_ps(maxX, ix);
+			const __m128 ty1 = _mm_mul_ps(minY, iy), ty2 = _mm_mul_ps(maxY, iy);
+			const __m128 tn = _mm_max_ps(zero, _mm_max_ps(_mm_min_ps(ty2, ty1), _mm_min_ps(tx2, tx1)));
+			const __m128 tf = _mm_min_ps(_mm_max_ps(ty2, ty1), _mm_max_ps(tx2, tx1));
+			const __m128 limit = _mm_setr_ps(q[base].limit(), q[base + 1].limit(), q[base + 2].limit(), q[base + 3].limit());
+			const __m128 in = _mm_and_ps(_mm_cmple_ps(tn, tf), _mm_cmple_ps(tn, limit));
+
+			u32 bits = (u32(_mm_movemask_ps(in)) << base) & mask;
+			if (bits == 0) continue;
+			hit |= bits;
+			_mm_store_ps(nears, tn);
+			for (u32 i = 0; i < 4; i++) {
+				if (bits & (1u << (base + i))) tnear = std::min(tnear, nears[i]);
+			}
+		}
+#else
+		for (u32 i = 0; i < rays.size; i++) {
+			if (!(mask & (1u << i))) continue;
+			const f32 t = ::slab(n, o, invX[i], invY[i], q[i].limit());
+			if (t != std::numeric_limits<f32>::infinity()) {
+				hit |= 1u << i;
+				tnear = std::min(tnear, t);
+			}
+		}
+#endif
+		return hit;
+	}
+
+	// One segment against the lanes of mask, with the same operations as raySeg per lane
+	void intersect(const Segment& seg, u32 mask, RayStats* stats) {
+		const Vec3& o = rays.origin;
+		const f32 v1x = o.x - seg.a.x, v1y = o.y - seg.a.y;
+		const f32 dx = seg.b.x - seg.a.x, dy = seg.b.y - seg.a.y;
+		const f32 num = dx * v1y - dy * v1x;
+
+		auto add = [&](u32 lane, f32 t, f32 u) {
+			q[lane].add(seg.line, Vec3(seg.a.x + dx * u, seg.a.y + dy * u, 0.0f), Vec3(-dy, dx), t, u);
+		};
+
+		if (stats) stats->tests += u32(std::bitset<RayPacket::maxSize>(mask).count());
+#if defined(SIMD_SSE)
+		const __m128 vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy);
+		const __m128 vv1x = _mm_set1_ps(v1x), vv1y = _mm_set1_ps(v1y);
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		alignas(16) f32 ts[4], us[4];
+		for (u32 base = 0; base < rays.size; base += 4) {
+			if (((mask >> base) & 0xF) == 0) continue;
+			const __m128 v3x = _mm_loadu_ps(&this->v3x[base]), v3y = _mm_loadu_ps(&rays.dx[base]);
+			const __m128 d23 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vdx, v3x), _mm_mul_ps(vdy, v3y)), zero);
+			const __m128 t = _mm_div_ps(_mm_set1_ps(num), d23);
+			const __m128 u = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vv1x, v3x), _mm_mul_ps(vv1y, v3y)), zero), d23);
+			__m128 in = _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmpge_ps(u, zero));
+			in = _mm_and_ps(in, _mm_cmple_ps(u, one));
+
+			const u32 bits = (u32(_mm_movemask_ps(in)) << base) & mask;
+			if (bits == 0) continue;
+			_mm_store_ps(ts, t);
+			_mm_store_ps(us, u);
+			for (u32 i = 0; i < 4; i++) {
+				if (bits & (1u << (base + i))) add(base + i, ts[i], us[i]);
+			}
+		}
+#else
+		for (u32 i = 0; i < rays.size; i++) {
+			if (!(mask & (1u << i))) continue;
+			const f32 d23 = (dx * v3x[i] + dy * rays.dx[i]) + 0.0f;
+			const f32 t = num / d23;
+			const f32 u = (v1x * v3x[i] + v1y * rays.dx[i] + 0.0f) / d23;
+			if (t >= 0.0f && u >= 0.0f && u <= 1.0f) add(i, t, u);
+		}
+#endif
+	}
+};
+
+void BVH::closestHitPacket(const RayPacket& rays, f32 tmax, SegmentHit* hits, u8* found, RayStats* stats) const {
+	Packet p(rays, tmax);
+
+	u32 stack[MAX_STACK], masks[MAX_STACK];
+	u32 sp = 0;
+	u32 node = 0;
+	f32 tnear;
+	u32 mask = m_nodes.empty() ? 0 : p.slab(m_nodes[0], (1u << rays.size) - 1u, tnear);
+	if (!m_nodes.empty() && stats) stats->nodes++;
+
+	while (mask != 0) {
+		const Node& n = m_nodes[node];
+		const u32 active = u32(std::bitset<RayPacket::maxSize>(mask).count());
+
+		if (active * PACKET_FALLBACK_DIVISOR <= rays.size) {
+			// Diverged: finish this subtree ray by ray
+			for (u32 i = 0; i < rays.size; i++) {
+				if (!(mask & (1u << i))) continue;
+				queryNode(node, rays.origin, p.ray(i), p.q[i], stats);
+				if (stats) stats->fallbacks++;
+			}
+		} else if (n.count > 0) {
+			for (u32 i = n.first; i < n.first + n.count; i++) {
+				p.intersect(m_segments[i], mask, stats);
+			}
+		} else {
+			u32 c0 = n.first, c1 = n.first + 1;
+			f32 d0, d1;
+			u32 m0 = p.slab(m_nodes[c0], mask, d0);
+			u32 m1 = p.slab(m_nodes[c1], mask, d1);
+			if (stats) stats->nodes += 2;
+			if (m1 != 0 && (m0 == 0 || d1 < d0)) {
+				std::swap(c0, c1);
+				std::swap(m0, m1);
+			}
+
+			if (m0 != 0) {
+				if (m1 != 0) {
+					assert(sp < MAX_STACK);
+					stack[sp] = c1;
+					masks[sp++] = m1;
+				}
+				node = c0;
+				mask = m0;
+				continue;
+			}
+		}
+
+		// Pop, dropping lanes whose closest hit is now in front of the node
+		mask = 0;
+		while (sp > 0 && mask == 0) {
+			node = stack[--sp];
+			mask = p.slab(m_nodes[node], masks[sp], tnear);
+			if (stats) stats->nodes++;
+		}
+	}
+
+	for (u32 i = 0; i < rays.size; i++) {
+		found[i] = p.q[i].found ? 1 : 0;
+		if (p.q[i].found) hits[i] = p.q[i].hit;
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "world.h"
+#include "segment_query.h"
+
+#include <vector>
+
+// Bounding volume hierarchy over the world-space line segments.
+// Built top-down with a binned SAH over segment centroids; closest-hit
+// traversal visits the nearer child first and culls by the running t-max.
+// Moving segments can be refit in place, which keeps the tree topology.
+class BVH {
+public:
+	struct Node {
+		f32 minX, minY, maxX, maxY;
+		u32 first; // leaf: first segment, inner: left child (right child is first + 1)
+		u32 count; // segments in a leaf, 0 for inner nodes
+	};
+
+	struct Stats {
+		u32 nodes, leaves, depth, segments;
+		f64 buildMs;
+	};
+
+	void build(const std::vector<Line>& lines);
+	// Updates the changed lines (same count as the build) and the bounds above them
+	void refit(const std::vector<Line>& lines, const std::vector<u32>& changed);
+
+	// Closest hit with t < tmax. hit.index is the index into the lines it was built from.
+	bool closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats = nullptr) const;
+
+	// Feeds the hits along a ray to a ClosestHit, AnyHit or SortedHits query
+	template <typename Query>
+	void query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats = nullptr) const;
+
+	// Closest hits of a packet of rays, traversed together and finished ray
+	// by ray once they diverge. Writes hits[i]/found[i] for every ray.
+	void closestHitPacket(const RayPacket& rays, f32 tmax, SegmentHit* hits, u8* found, RayStats* stats = nullptr) const;
+
+	const Stats& stats() const { return m_stats; }
+	bool empty() const { return m_nodes.empty(); }
+
+private:
+	struct Segment {
+		Vec3 a, b;
+		u32 line;
+	};
+
+	struct Packet;
+
+	template <typename Query>
+	void queryNode(u32 root, const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const;
+	u32 subdivide(u32 node, u32 first, u32 count, u32 depth);
+	void bounds(u32 first, u32 count, Node& node) const;
+
+	std::vector<Node> m_nodes;
+	std::vector<Segment> m_segments; // in leaf order
+	std::vector<Vec3> m_centroids;
+	std::vector<u32> m_slots; // line -> segment
+	std::vector<u32> m_leaves; // segment -> leaf node
+	Stats m_stats{};
+};
+
+#endif // BVH_H
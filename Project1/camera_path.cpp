@@ -0,0 +1,133 @@
+#include "camera_path.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+// Middle of the default scene (6x6 blocks room)
+static const Vec3 SCENE_CENTER(3.0f * blockSize, 3.0f * blockSize, 0.0f);
+
+CameraPath CameraPath::orbit(const Vec3& center, f32 radius, f32 duration, f32 fov) {
+	CameraPath path;
+	const u32 keys = 128;
+	for (u32 i = 0; i <= keys; i++) {
+		f32 t = f32(i) / keys;
+		f32 a = t * f32(M_PI) * 2.0f;
+
+		CameraKey key;
+		key.time = t * duration;
+		key.position = center + Vec3(a) * radius;
+		// Look along the tangent, slightly inwards
+		key.rotation = a + f32(M_PI) * 0.6f;
+		key.fov = fov;
+		path.add(key);
+	}
+	return path;
+}
+
+CameraPath CameraPath::spin(const Vec3& center, f32 duration, f32 fov) {
+	CameraPath path;
+	const u32 keys = 64;
+	for (u32 i = 0; i <= keys; i++) {
+		f32 t = f32(i) / keys;
+
+		CameraKey key;
+		key.time = t * duration;
+		key.position = center;
+		key.rotation = t * f32(M_PI) * 2.0f;
+		key.fov = fov;
+		path.add(key);
+	}
+	return path;
+}
+
+CameraPath CameraPath::zoom(const Vec3& center, f32 rotation, f32 duration) {
+	CameraPath path;
+	path.add({ 0.0f, center, rotation, rad(20) });
+	path.add({ duration * 0.5f, center, rotation, rad(120) });
+	path.add({ duration, center, rotation, rad(20) });
+	return path;
+}
+
+bool CameraPath::fromName(const std::string& name, CameraPath& path) {
+	if (name == "orbit") {
+		path = orbit(SCENE_CENTER, 2.5f * blockSize, 10.0f);
+	} else if (name == "spin") {
+		path = spin(SCENE_CENTER, 10.0f);
+	} else if (name == "zoom") {
+		path = zoom(SCENE_CENTER, 0.0f, 10.0f);
+	} else {
+		return path.load(name);
+	}
+	return true;
+}
+
+bool CameraPath::load(const std::string& fileName) {
+	std::ifstream in(fileName);
+	if (!in) return false;
+
+	m_keys.clear();
+
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.empty() || line[0] == '#' || line[0] == 't') continue; // comments/header
+		std::replace(line.begin(), line.end(), ',', ' ');
+
+		std::istringstream ss(line);
+		CameraKey key;
+		if (ss >> key.time >> key.position.x >> key.position.y >> key.rotation >> key.fov) {
+			m_keys.push_back(key);
+		}
+	}
+	return !m_keys.empty();
+}
+
+bool CameraPath::save(const std::string& fileName) const {
+	std::ofstream out(fileName);
+	if (!out) return false;
+
+	out << "time,x,y,rotation,fov\n";
+	for (auto&& key : m_keys) {
+		out << key.time << "," << key.position.x << "," << key.position.y << ","
+			<< key.rotation << "," << key.fov << "\n";
+	}
+	return bool(out);
+}
+
+void CameraPath::add(const Viewer& viewer, f32 time) {
+	CameraKey key;
+	key.time = time;
+	key.position = viewer.position;
+	key.rotation = viewer.rotation;
+	key.fov = viewer.fov;
+	m_keys.push_back(key);
+}
+
+CameraKey CameraPath::sample(f32 time) const {
+	if (m_keys.empty()) return CameraKey{ 0.0f, Vec3(), 0.0f, rad(90) };
+	if (m_keys.size() == 1 || time <= m_keys.front().time) return m_keys.front();
+	if (time >= m_keys.back().time) return m_keys.back();
+
+	auto it = std::upper_bound(m_keys.begin(), m_keys.end(), time, [](f32 t, const CameraKey& k) {
+		return t < k.time;
+	});
+	const CameraKey& b = *it;
+	const CameraKey& a = *(it - 1);
+
+	f32 span = b.time - a.time;
+	f32 fac = span > 0.0f ? (time - a.time) / span : 0.0f;
+
+	CameraKey key;
+	key.time = time;
+	key.position = a.position.lerp(b.position, fac);
+	key.rotation = a.rotation * (1.0f - fac) + b.rotation * fac;
+	key.fov = a.fov * (1.0f - fac) + b.fov * fac;
+	return key;
+}
+
+void CameraPath::apply(Viewer& viewer, f32 time) const {
+	CameraKey key = sample(time);
+	viewer.position = key.position;
+	viewer.rotation = key.rotation;
+	viewer.fov = key.fov;
+}
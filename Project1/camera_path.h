@@ -0,0 +1,44 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include "world.h"
+
+#include <string>
+#include <vector>
+
+struct CameraKey {
+	f32 time;
+	Vec3 position;
+	f32 rotation, fov;
+};
+
+// A timed list of viewer poses, either recorded from a play session or
+// generated procedurally. Sampling interpolates linearly between keys.
+class CameraPath {
+public:
+	CameraPath() = default;
+
+	static CameraPath orbit(const Vec3& center, f32 radius, f32 duration, f32 fov = rad(90));
+	static CameraPath spin(const Vec3& center, f32 duration, f32 fov = rad(90));
+	static CameraPath zoom(const Vec3& center, f32 rotation, f32 duration);
+
+	// A procedural name ("orbit", "spin", "zoom") or a recorded CSV file
+	static bool fromName(const std::string& name, CameraPath& path);
+
+	bool load(const std::string& fileName);
+	bool save(const std::string& fileName) const;
+
+	void add(const CameraKey& key) { m_keys.push_back(key); }
+	void add(const Viewer& viewer, f32 time);
+
+	void apply(Viewer& viewer, f32 time) const;
+	CameraKey sample(f32 time) const;
+
+	f32 duration() const { return m_keys.empty() ? 0.0f : m_keys.back().time; }
+	bool empty() const { return m_keys.empty(); }
+
+private:
+	std::vector<CameraKey> m_keys;
+};
+
+#endif // CAMERA_PATH_H
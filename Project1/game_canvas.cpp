@@ -1,7 +1,11 @@
 #include "game_canvas.h"
+#include "palette.h"
+#include "pixel.h"
+#include "stb_image_write.h"
 
 #include <iostream>
 #include <algorithm>
+#include <cstdio>
 
 static const u8 FONT[] = {
 	0x00, 0x00, 0x00, 0x00, 0x00,// (space)
@@ -104,21 +108,61 @@ static const u8 FONT[] = {
 
 #define Clamp(x, a, b) (x < a ? a : x > b ? b : x)
 #define Log(x) std::cerr << x << std::endl
-#define Col(v) u8(Clamp(v * 255.0f, 0.0f, 255.0f));
+#define Col(v) u32(Clamp(v * 255.0f, 0.0f, 255.0f))
 
-GameCanvas::GameCanvas(GameAdapter *adapter, u32 width, u32 height, u32 downScale) {
-	if (SDL_Init(SDL_INIT_EVERYTHING) > 0) {
-		Log(SDL_GetError());
-		return;
+static u32 packFloat(f32 r, f32 g, f32 b) {
+	return packRGB(Col(r), Col(g), Col(b));
+}
+
+// Columns of an indexed column-major frame expanded per pass at present
+const u32 STRIP_COLUMNS = 32;
+
+const u32 GLYPH_W = 5, GLYPH_H = 7, GLYPH_ADVANCE = 7, GLYPH_COUNT = 96;
+
+// FONT stores a bit per row in each of the 5 column bytes, the masks have a
+// full pixel per bit, in rows
+struct GlyphMasks {
+	u32 mask[GLYPH_COUNT][GLYPH_H][GLYPH_W];
+
+	GlyphMasks() {
+		for (u32 c = 0; c < GLYPH_COUNT; c++) {
+			for (u32 fy = 0; fy < GLYPH_H; fy++) {
+				for (u32 fx = 0; fx < GLYPH_W; fx++) {
+					mask[c][fy][fx] = (FONT[c * GLYPH_W + fx] >> fy) & 1u ? 0xFFFFFFFF : 0;
+				}
+			}
+		}
 	}
+};
+
+static const GlyphMasks GLYPHS;
+
+static u32 glyphIndex(char c) {
+	c = c & 0x7F;
+	return c < ' ' ? 0 : u32(c - ' ');
+}
 
+GameCanvas::GameCanvas(GameAdapter *adapter, u32 width, u32 height, u32 downScale, bool headless) {
 	downScale = std::max(std::min(downScale, u32(6)), u32(1));
 	m_width = width / downScale;
 	m_height = height / downScale;
 	m_adapter = std::unique_ptr<GameAdapter>(adapter);
+	m_headless = headless;
 
 	Log("SZ: " << m_width << "x" << m_height);
 
+	// The image is drawn on the CPU in both modes, windows get the dirty regions uploaded
+	m_framebuffer.resize(m_width * m_height, 0);
+	m_pixels = m_framebuffer.data();
+	m_pitch = m_width;
+
+	if (m_headless) return;
+
+	if (SDL_Init(SDL_INIT_EVERYTHING) > 0) {
+		Log(SDL_GetError());
+		return;
+	}
+
 	m_window = SDL_CreateWindow(
 		"Game Canvas",
 		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -140,34 +184,185 @@ GameCanvas::GameCanvas(GameAdapter *adapter, u32 width, u32 height, u32 downScal
 
 	m_buffer = SDL_CreateTexture(
 		m_renderer,
-		SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING,
+		SDL_PIXELFORMAT_BGR888, SDL_TEXTUREACCESS_STREAMING, // 0x00BBGGRR, as packRGB
 		m_width, m_height
 	);
 
 }
 
 void GameCanvas::clear(f32 r, f32 g, f32 b) {
-	for (u32 i = 0; i < m_width * m_height; i++) {
-		m_pixels[i * 3 + 0] = Col(r);
-		m_pixels[i * 3 + 1] = Col(g);
-		m_pixels[i * 3 + 2] = Col(b);
-	}
+	fill(0, 0, m_width, m_height, packFloat(r, g, b));
 }
 
 void GameCanvas::put(i32 x, i32 y, f32 r, f32 g, f32 b) {
+	put(x, y, packFloat(r, g, b));
+}
+
+void GameCanvas::put(i32 x, i32 y, u32 rgb) {
+	plot(x, y, rgb);
+	markDirty(x, y, 1, 1);
+}
+
+void GameCanvas::plot(i32 x, i32 y, u32 rgb) {
 	if (x < 0 || x >= m_width || y < 0 || y >= m_height) return;
-	u32 i = (x + y * m_width) * 3;
-	m_pixels[i + 0] = Col(r);
-	m_pixels[i + 1] = Col(g);
-	m_pixels[i + 2] = Col(b);
+	if (indexed()) *indexPixel(x, y) = m_palette->nearest(rgb);
+	else *pixel(x, y) = rgb;
+}
+
+u32 GameCanvas::at(u32 x, u32 y) const {
+	const u32 i = x * m_xStep + y * m_pitch;
+	return indexed() ? m_palette->color(m_indices[i]) : m_pixels[i];
+}
+
+void GameCanvas::hspan(i32 x0, i32 x1, i32 y, u32 rgb) {
+	if (x1 > x0) fill(x0, y, x1 - x0, 1, rgb);
+}
+
+void GameCanvas::vspan(i32 x, i32 y0, i32 y1, u32 rgb) {
+	if (x < 0 || x >= m_width) return;
+	markDirty(x, y0, 1, std::max(y1 - y0, 0));
+	y0 = std::max(y0, 0);
+	y1 = std::min(y1, i32(m_height));
+	if (indexed()) {
+		const u8 c = m_palette->nearest(rgb);
+		u8* p = indexPixel(x, 0);
+		for (i32 y = y0; y < y1; y++) {
+			p[y * m_pitch] = c;
+		}
+		return;
+	}
+	u32* p = pixel(x, 0);
+	for (i32 y = y0; y < y1; y++) {
+		p[y * m_pitch] = rgb;
+	}
+}
+
+void GameCanvas::setColumnMajor(bool columnMajor) {
+	m_columnMajor = columnMajor;
+	m_xStep = columnMajor ? m_height : 1;
+	m_pitch = columnMajor ? 1 : m_width;
+	m_rows.assign(columnMajor || indexed() ? m_width * m_height : 0, 0);
+	m_strip.assign(columnMajor && indexed() ? STRIP_COLUMNS * m_height : 0, 0);
+	std::fill(m_framebuffer.begin(), m_framebuffer.end(), 0);
+	std::fill(m_indices.begin(), m_indices.end(), 0);
+	markDirty(0, 0, m_width, m_height);
+}
+
+void GameCanvas::setPalette(const Palette* palette) {
+	m_palette = palette;
+	// One image at a time: indices while indexed, packed pixels otherwise
+	m_indices.assign(indexed() ? m_width * m_height : 0, 0);
+	m_indices.shrink_to_fit();
+	m_framebuffer.assign(indexed() ? 0 : m_width * m_height, 0);
+	m_framebuffer.shrink_to_fit();
+	m_pixels = indexed() ? nullptr : m_framebuffer.data();
+	m_rows.assign(m_columnMajor || indexed() ? m_width * m_height : 0, 0);
+	m_strip.assign(m_columnMajor && indexed() ? STRIP_COLUMNS * m_height : 0, 0);
+	markDirty(0, 0, m_width, m_height);
+}
+
+void GameCanvas::fill(i32 x, i32 y, u32 w, u32 h, u32 rgb) {
+	const i32 x0 = std::max(x, 0), x1 = std::min(x + i32(w), i32(m_width));
+	const i32 y0 = std::max(y, 0), y1 = std::min(y + i32(h), i32(m_height));
+	if (x0 >= x1 || y0 >= y1) return;
+	if (indexed()) {
+		const u8 c = m_palette->nearest(rgb);
+		if (m_columnMajor) {
+			for (i32 rx = x0; rx < x1; rx++) std::fill_n(indexPixel(rx, y0), y1 - y0, c);
+		} else {
+			for (i32 ry = y0; ry < y1; ry++) std::fill_n(indexPixel(x0, ry), x1 - x0, c);
+		}
+	} else if (m_columnMajor) {
+		for (i32 rx = x0; rx < x1; rx++) {
+			fillRGB(pixel(rx, y0), y1 - y0, rgb);
+		}
+	} else {
+		for (i32 ry = y0; ry < y1; ry++) {
+			fillRGB(pixel(x0, ry), x1 - x0, rgb);
+		}
+	}
+	markDirty(x0, y0, x1 - x0, y1 - y0);
 }
 
 void GameCanvas::rect(i32 x, i32 y, u32 w, u32 h, f32 r, f32 g, f32 b) {
-	for (i32 ry = y; ry < y + h; ry++) {
-		for (i32 rx = x; rx < x + w; rx++) {
-			put(rx, ry, r, g, b);
+	fill(x, y, w, h, packFloat(r, g, b));
+}
+
+void GameCanvas::markDirty(i32 x, i32 y, u32 w, u32 h) {
+	i32 x0 = std::max(x, 0), x1 = std::min(x + i32(w), i32(m_width));
+	i32 y0 = std::max(y, 0), y1 = std::min(y + i32(h), i32(m_height));
+	if (x0 >= x1 || y0 >= y1) return;
+
+	// Text and spans arrive as runs of touching rects, grow the last one while they touch
+	if (!m_dirty.empty()) {
+		Rect& last = m_dirty.back();
+		if (x0 <= last.x + last.w && x1 >= last.x && y0 <= last.y + last.h && y1 >= last.y) {
+			x0 = std::min(x0, last.x); x1 = std::max(x1, last.x + last.w);
+			y0 = std::min(y0, last.y); y1 = std::max(y1, last.y + last.h);
+			last = Rect{ x0, y0, x1 - x0, y1 - y0 };
+			return;
 		}
 	}
+
+	// Past a few rects one upload of their bounds is cheaper than many small ones
+	const u32 maxRects = 16;
+	if (m_dirty.size() == maxRects) {
+		for (const Rect& d : m_dirty) {
+			x0 = std::min(x0, d.x); x1 = std::max(x1, d.x + d.w);
+			y0 = std::min(y0, d.y); y1 = std::max(y1, d.y + d.h);
+		}
+		m_dirty.clear();
+	}
+	m_dirty.push_back(Rect{ x0, y0, x1 - x0, y1 - y0 });
+}
+
+void GameCanvas::present() {
+	// Column-major and indexed frames are turned into packed rows here, headless
+	// too so that timings include it
+	if (indexed()) {
+		for (const Rect& d : m_dirty) {
+			u32* out = &m_rows[d.y * m_width + d.x];
+			if (!m_columnMajor) {
+				for (i32 ry = 0; ry < d.h; ry++) expandRGB(out + ry * m_width, indexPixel(d.x, d.y + ry), d.w, m_palette->colors());
+				continue;
+			}
+			// Columns expanded into a packed column-major strip, then transposed like packed frames
+			for (i32 sx = 0; sx < d.w; sx += STRIP_COLUMNS) {
+				const u32 sw = std::min(STRIP_COLUMNS, u32(d.w - sx));
+				for (u32 rx = 0; rx < sw; rx++) {
+					expandRGB(&m_strip[rx * d.h], indexPixel(d.x + sx + rx, d.y), d.h, m_palette->colors());
+				}
+				transposeRGB(m_strip.data(), d.h, out + sx, m_width, sw, d.h);
+			}
+		}
+	} else if (m_columnMajor) {
+		for (const Rect& d : m_dirty) {
+			transposeRGB(pixel(d.x, d.y), m_height, &m_rows[d.y * m_width + d.x], m_width, d.w, d.h);
+		}
+	}
+
+	if (m_buffer) {
+		const u32* rows = m_columnMajor || indexed() ? m_rows.data() : m_pixels;
+		for (const Rect& d : m_dirty) {
+			SDL_Rect area{ d.x, d.y, d.w, d.h };
+			SDL_UpdateTexture(m_buffer, &area, rows + d.y * m_width + d.x, i32(m_width * sizeof(u32)));
+		}
+		SDL_RenderCopy(m_renderer, m_buffer, nullptr, nullptr);
+		SDL_RenderPresent(m_renderer);
+	}
+	m_dirty.clear();
+
+	if (m_textDrawn) {
+		for (auto it = m_texts.begin(); it != m_texts.end();) {
+			if (!it->second.used) {
+				it = m_texts.erase(it);
+			} else {
+				it->second.used = false;
+				++it;
+			}
+		}
+		m_textDrawn = false;
+	}
 }
 
 void GameCanvas::line(i32 x1, i32 y1, i32 x2, i32 y2, f32 r, f32 g, f32 b) {
@@ -181,8 +376,11 @@ void GameCanvas::line(i32 x1, i32 y1, i32 x2, i32 y2, f32 r, f32 g, f32 b) {
 	int x = x1;
 	int y = y1;
 
+	const u32 c = packFloat(r, g, b);
+	markDirty(std::min(x1, x2), std::min(y1, y2), dx + 1, -dy + 1);
+
 	while (true) {
-		put(x, y, r, g, b);
+		plot(x, y, c);
 
 		if (x == x2 && y == y2) break;
 		e2 = 2 * err;
@@ -191,33 +389,189 @@ void GameCanvas::line(i32 x1, i32 y1, i32 x2, i32 y2, f32 r, f32 g, f32 b) {
 	}
 }
 
+void GameCanvas::blit(const u32* mask, u32 pitch, u32 w, u32 h, i32 x, i32 y, u32 rgb) {
+	const i32 x0 = std::max(x, 0), x1 = std::min(x + i32(w), i32(m_width));
+	const i32 y0 = std::max(y, 0), y1 = std::min(y + i32(h), i32(m_height));
+	if (x0 >= x1 || y0 >= y1) return;
+	const u8 index = indexed() ? m_palette->nearest(rgb) : 0;
+	for (i32 ry = y0; ry < y1; ry++) {
+		const u32* m = mask + (ry - y) * pitch + (x0 - x);
+		if (indexed()) {
+			for (i32 rx = x0; rx < x1; rx++) {
+				if (m[rx - x0]) *indexPixel(rx, ry) = index;
+			}
+			continue;
+		}
+		if (!m_columnMajor) {
+			blendRGB(pixel(x0, ry), m, x1 - x0, rgb);
+			continue;
+		}
+		for (i32 rx = x0; rx < x1; rx++) {
+			u32& p = *pixel(rx, ry);
+			p = (p & ~m[rx - x0]) | (rgb & m[rx - x0]);
+		}
+	}
+	markDirty(x0, y0, x1 - x0, y1 - y0);
+}
+
 i32 GameCanvas::chr(char c, i32 x, i32 y, f32 r, f32 g, f32 b) {
-	c = c & 0x7F;
-	if (c < ' ') {
-		c = 0;
-	} else {
-		c -= ' ';
+	blit(&GLYPHS.mask[glyphIndex(c)][0][0], GLYPH_W, GLYPH_W, GLYPH_H, x, y, packFloat(r, g, b));
+	return x + GLYPH_ADVANCE;
+}
+
+i32 GameCanvas::str(const std::string& txt, i32 x, i32 y, f32 r, f32 g, f32 b) {
+	if (txt.empty()) return x;
+
+	auto it = m_texts.find(txt);
+	if (it == m_texts.end()) {
+		Text text;
+		text.width = u32(txt.size() - 1) * GLYPH_ADVANCE + GLYPH_W;
+		text.mask.assign(text.width * GLYPH_H, 0);
+		for (u32 i = 0; i < txt.size(); i++) {
+			const u32 c = glyphIndex(txt[i]);
+			for (u32 fy = 0; fy < GLYPH_H; fy++) {
+				std::copy_n(GLYPHS.mask[c][fy], GLYPH_W, &text.mask[fy * text.width + i * GLYPH_ADVANCE]);
+			}
+		}
+		it = m_texts.emplace(txt, std::move(text)).first;
 	}
 
-	const u8* dat = &FONT[c * 5];
+	Text& text = it->second;
+	text.used = true;
+	m_textDrawn = true;
+	blit(text.mask.data(), text.width, text.width, GLYPH_H, x, y, packFloat(r, g, b));
+	return x + i32(txt.size() * GLYPH_ADVANCE);
+}
 
-	for (i32 fx = 0; fx < 5; fx++) {
-		for (i32 fy = 0; fy < 7; fy++) {
-			if ((dat[fx] >> fy) & 1u) put(fx + x, fy + y, r, g, b);
+bool GameCanvas::save(const std::string& fileName) const {
+	if (!hasImage()) return false;
+	std::vector<u8> rgb;
+	rgb.reserve(m_width * m_height * 3);
+	for (u32 y = 0; y < m_height; y++) {
+		for (u32 x = 0; x < m_width; x++) {
+			const u32 c = at(x, y);
+			rgb.push_back(u8(red(c)));
+			rgb.push_back(u8(green(c)));
+			rgb.push_back(u8(blue(c)));
 		}
 	}
-	return x + 7;
+	return stbi_write_png(fileName.c_str(), m_width, m_height, 3, rgb.data(), m_width * 3) != 0;
 }
 
-i32 GameCanvas::str(const std::string& txt, i32 x, i32 y, f32 r, f32 g, f32 b) {
-	i32 tx = x;
-	for (auto&& c : txt) {
-		tx = chr(c, tx, y, r, g, b);
+u64 GameCanvas::checksum() const {
+	// FNV-1a over the R, G, B bytes of every pixel, used to check that frames are reproducible
+	u64 hash = 14695981039346656037ull;
+	if (!hasImage()) return hash;
+	for (u32 y = 0; y < m_height; y++) {
+		for (u32 x = 0; x < m_width; x++) {
+			const u32 c = at(x, y);
+			const u32 bytes[] = { red(c), green(c), blue(c) };
+			for (u32 b : bytes) {
+				hash ^= b;
+				hash *= 1099511628211ull;
+			}
+		}
 	}
-	return tx;
+	return hash;
+}
+
+// A dump pattern holds exactly one frame number, %d or %0Nd, and "%%" for a
+// literal percent sign. Any other '%' is rejected, the pattern is never handed to printf.
+struct FramePattern {
+	std::string prefix, suffix;
+	u32 width{ 0 };
+
+	bool parse(const std::string& pattern) {
+		bool found = false;
+		for (size_t i = 0; i < pattern.size(); i++) {
+			std::string& out = found ? suffix : prefix;
+			if (pattern[i] != '%') {
+				out += pattern[i];
+				continue;
+			}
+			if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+				out += '%';
+				i++;
+				continue;
+			}
+			if (found) return false;
+
+			size_t j = i + 1;
+			if (j < pattern.size() && pattern[j] == '0') {
+				j++;
+				while (j < pattern.size() && pattern[j] >= '0' && pattern[j] <= '9' && width < 100) {
+					width = width * 10 + u32(pattern[j++] - '0');
+				}
+			}
+			if (j >= pattern.size() || pattern[j] != 'd') return false;
+			found = true;
+			i = j;
+		}
+		return found;
+	}
+
+	std::string name(u32 frame) const {
+		std::string number = std::to_string(frame);
+		if (number.size() < width) number.insert(0, width - number.size(), '0');
+		return prefix + number + suffix;
+	}
+};
+
+i32 GameCanvas::runHeadless(u32 frames, f32 dt, const std::string& dumpPath) {
+	if (!m_headless || !hasImage())
+		return -1;
+
+	FramePattern dump;
+	if (!dumpPath.empty() && !dump.parse(dumpPath)) {
+		Log("Invalid dump pattern (needs one %d or %0Nd): " << dumpPath);
+		return -1;
+	}
+
+	m_adapter->onSetup(this);
+
+	const f64 freq = f64(SDL_GetPerformanceFrequency());
+	f64 total = 0.0, best = 1e9, worst = 0.0;
+
+	for (u32 i = 0; i < frames; i++) {
+		m_adapter->onUpdate(this, dt);
+
+		u64 start = SDL_GetPerformanceCounter();
+		m_profiler.beginFrame();
+		m_adapter->onDraw(this);
+		u64 t0 = m_profiler.now();
+		present();
+		m_profiler.add(Stage::Present, t0);
+		m_profiler.endFrame();
+		f64 elapsed = f64(SDL_GetPerformanceCounter() - start) / freq * 1000.0;
+
+		total += elapsed;
+		best = std::min(best, elapsed);
+		worst = std::max(worst, elapsed);
+
+		if (!dumpPath.empty()) {
+			const std::string fileName = dump.name(i);
+			if (!save(fileName)) {
+				Log("Failed to write " << fileName);
+			}
+		}
+	}
+
+	if (frames > 0) {
+		Log("FRAMES: " << frames);
+		Log("MS: avg " << (total / frames) << ", min " << best << ", max " << worst);
+		Log("HASH: " << std::hex << checksum() << std::dec);
+		if (m_profiler.enabled()) {
+			m_profiler.printSummary();
+		}
+	}
+
+	return 0;
 }
 
 i32 GameCanvas::run() {
+	if (m_headless)
+		return runHeadless(1);
+
 	if (m_renderer == nullptr || m_window == nullptr || m_buffer == nullptr)
 		return -1;
 
@@ -263,16 +617,19 @@ i32 GameCanvas::run() {
 		}
 
 		if (canRender) {
-			int pitch;
-			SDL_LockTexture(m_buffer, nullptr, (void**) &m_pixels, &pitch);
+			m_profiler.beginFrame();
 			m_adapter->onDraw(this);
-			SDL_UnlockTexture(m_buffer);
 
-			SDL_RenderCopy(m_renderer, m_buffer, nullptr, nullptr);
-			SDL_RenderPresent(m_renderer);
+			u64 t0 = m_profiler.now();
+			present();
+			m_profiler.add(Stage::Present, t0);
+			m_profiler.endFrame();
 		}
 	}
 
+	if (m_profiler.enabled()) {
+		m_profiler.printSummary();
+	}
 
 	SDL_DestroyTexture(m_buffer);
 	SDL_DestroyRenderer(m_renderer);
@@ -2,15 +2,20 @@
 #define GAME_CANVAS_H
 
 #include "integer.h"
+#include "profiler.h"
 #include "SDL.h"
 
 #include <memory>
+#include <string>
 #include <vector>
 #include <unordered_map>
 
 class GameCanvas;
+class Palette;
 class GameAdapter {
 public:
+	virtual ~GameAdapter() = default;
+
 	virtual void onSetup(GameCanvas *canvas) {}
 	virtual void onUpdate(GameCanvas *canvas, f32 dt) {}
 	virtual void onDraw(GameCanvas *canvas) {}
@@ -18,35 +23,117 @@ public:
 
 class GameCanvas {
 public:
+	struct Rect {
+		i32 x, y, w, h;
+	};
+
 	GameCanvas() {}
-	GameCanvas(GameAdapter *adapter, u32 width, u32 height, u32 downScale = 2);
+	GameCanvas(GameAdapter *adapter, u32 width, u32 height, u32 downScale = 2, bool headless = false);
 
 	void clear(f32 r = 0.0f, f32 g = 0.0f, f32 b = 0.0f);
 	void put(i32 x, i32 y, f32 r, f32 g, f32 b);
+	void put(i32 x, i32 y, u32 rgb); // packed, see pixel.h
+	// Clipped packed fills, x1 and y1 exclusive
+	void hspan(i32 x0, i32 x1, i32 y, u32 rgb);
+	void vspan(i32 x, i32 y0, i32 y1, u32 rgb);
+	void fill(i32 x, i32 y, u32 w, u32 h, u32 rgb);
 	void rect(i32 x, i32 y, u32 w, u32 h, f32 r, f32 g, f32 b);
 	void line(i32 x1, i32 y1, i32 x2, i32 y2, f32 r, f32 g, f32 b);
 
+	// 5x7 glyphs, 7 pixels apart. Strings are rendered once into a mask and blitted
+	// from it while they keep being drawn; strings not drawn in a frame that drew
+	// text are dropped at present.
 	i32 chr(char c, i32 x, i32 y, f32 r = 1.0f, f32 g = 1.0f, f32 b = 1.0f);
 	i32 str(const std::string& txt, i32 x, i32 y, f32 r = 1.0f, f32 g = 1.0f, f32 b = 1.0f);
 
 	i32 run();
 
+	// Runs N frames with a fixed dt into a CPU framebuffer (no window/renderer).
+	// dumpPath holds one frame number as %d or %0Nd, e.g. "frame_%04d.png"
+	i32 runHeadless(u32 frames, f32 dt = 1.0f / 60.0f, const std::string& dumpPath = "");
+
+	bool save(const std::string& fileName) const;
+	u64 checksum() const;
+
+	// Regions drawn since the last present, only these are uploaded to the window.
+	// The drawing functions mark what they touch; writes through pixel()
+	// must be marked by the caller. A frame that marks nothing keeps the last image.
+	void markDirty(i32 x, i32 y, u32 w, u32 h);
+	const std::vector<Rect>& dirty() const { return m_dirty; }
+
+	// Direct access to the packed framebuffer, which keeps its contents between
+	// frames. Not allocated while indexed(), see indexPixel(). Neighbours are xStep() pixels apart across and pitch() pixels apart
+	// down, so a wall column is pixel(x, y0)[i * pitch()].
+	// No bounds checks, callers clip their spans.
+	u32* pixel(u32 x, u32 y) { return m_pixels + x * m_xStep + y * m_pitch; }
+	u32 xStep() const { return m_xStep; }
+	u32 pitch() const { return m_pitch; }
+
+	// Stores the framebuffer column by column (pitch() == 1), so column spans are
+	// sequential; present() transposes the dirty regions into rows. Call before run().
+	void setColumnMajor(bool columnMajor);
+	bool columnMajor() const { return m_columnMajor; }
+
+	// Indexed color: the image is one palette index per pixel and the packed
+	// framebuffer is released, present() expands the dirty regions through the
+	// palette. The drawing functions use the nearest entry to their color, writes
+	// through indexPixel() (same steps as pixel()) store indices. nullptr goes back
+	// to packed pixels. The palette must outlive the canvas, call before drawing,
+	// e.g. from onSetup().
+	void setPalette(const Palette* palette);
+	bool indexed() const { return m_palette != nullptr; }
+	u8* indexPixel(u32 x, u32 y) { return m_indices.data() + x * m_xStep + y * m_pitch; }
+
 	u32 width() const { return m_width; }
 	u32 height() const { return m_height; }
+	bool headless() const { return m_headless; }
+
+	Profiler& profiler() { return m_profiler; }
 
 	bool isPressed(u32 key) { return m_keyboard[key].pressed; }
 	bool isReleased(u32 key) { return m_keyboard[key].released; }
 	bool isHeld(u32 key) { return m_keyboard[key].held; }
 
 private:
-	SDL_Window *m_window;
-	SDL_Renderer *m_renderer;
-	SDL_Texture *m_buffer;
+	SDL_Window *m_window{ nullptr };
+	SDL_Renderer *m_renderer{ nullptr };
+	SDL_Texture *m_buffer{ nullptr };
 
 	std::unique_ptr<GameAdapter> m_adapter;
 
-	u32 m_width, m_height;
-	u8* m_pixels;
+	u32 m_width{ 0 }, m_height{ 0 }, m_xStep{ 1 }, m_pitch{ 0 };
+	u32* m_pixels{ nullptr };
+
+	bool m_headless{ false };
+	bool m_columnMajor{ false };
+	std::vector<u32> m_framebuffer;
+	// Row-major packed copy of a column-major or indexed framebuffer, updated at present
+	std::vector<u32> m_rows;
+	const Palette* m_palette{ nullptr };
+	std::vector<u8> m_indices;
+	// Packed columns of an indexed column-major frame on their way to m_rows
+	std::vector<u32> m_strip;
+
+	std::vector<Rect> m_dirty;
+
+	// Rendered strings, one mask pixel per framebuffer pixel
+	struct Text {
+		u32 width{ 0 };
+		std::vector<u32> mask;
+		bool used{ false };
+	};
+	std::unordered_map<std::string, Text> m_texts;
+	bool m_textDrawn{ false };
+
+	Profiler m_profiler;
+
+	void plot(i32 x, i32 y, u32 rgb);
+	// Sets the pixels of a w x h mask (rows pitch apart) at x, y to rgb, clipped
+	void blit(const u32* mask, u32 pitch, u32 w, u32 h, i32 x, i32 y, u32 rgb);
+	u32 at(u32 x, u32 y) const;
+	// A framebuffer of either kind to draw into
+	bool hasImage() const { return m_pixels != nullptr || indexed(); }
+	void present();
 
 	struct State {
 		bool pressed, released, held;
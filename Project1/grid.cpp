@@ -0,0 +1,231 @@
+#include "grid.h"
+
+#include "SDL.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Average number of segment references per cell the automatic sizing aims for
+static const f32 TARGET_PER_CELL = 2.0f;
+static const u32 MAX_CELLS_PER_AXIS = 1024;
+// Cells are padded so segments lying on a cell edge are referenced by both cells
+static const f32 CELL_PADDING = 1e-3f;
+
+void Grid::build(const std::vector<Line>& lines, f32 cellSize) {
+	u64 start = SDL_GetPerformanceCounter();
+
+	m_segments.clear();
+	m_cellStart.clear();
+	m_refs.clear();
+	m_stats = Stats{};
+
+	if (lines.empty()) return;
+
+	f32 minX = std::numeric_limits<f32>::max(), minY = minX;
+	f32 maxX = -std::numeric_limits<f32>::max(), maxY = maxX;
+	f32 totalLength = 0.0f;
+
+	m_segments.reserve(lines.size());
+	for (auto&& line : lines) {
+		Segment seg;
+		seg.a = line.a;
+		seg.b = line.b;
+		m_segments.push_back(seg);
+
+		minX = std::min(minX, std::min(seg.a.x, seg.b.x));
+		minY = std::min(minY, std::min(seg.a.y, seg.b.y));
+		maxX = std::max(maxX, std::max(seg.a.x, seg.b.x));
+		maxY = std::max(maxY, std::max(seg.a.y, seg.b.y));
+		totalLength += (seg.b - seg.a).length();
+	}
+
+	m_autoSize = cellSize <= 0.0f;
+	if (cellSize <= 0.0f) {
+		// A segment of length L crosses about L / cellSize + 1 cells, so the
+		// reference count for a cell size c is roughly totalLength / c + N.
+		// Pick c so that spreads over the area at TARGET_PER_CELL per cell.
+		const f32 area = std::max((maxX - minX) * (maxY - minY), 1.0f);
+		const f32 n = f32(m_segments.size());
+		f32 c = std::sqrt(area * TARGET_PER_CELL / std::max(n, 1.0f));
+		for (u32 i = 0; i < 4; i++) {
+			f32 refs = totalLength / c + n;
+			c = std::sqrt(area * TARGET_PER_CELL / refs);
+		}
+		cellSize = std::min(std::max(c, blockSize / 8.0f), blockSize);
+	}
+
+	m_cellSize = cellSize;
+	m_minX = minX - CELL_PADDING;
+	m_minY = minY - CELL_PADDING;
+	m_cellsX = std::min(u32((maxX - m_minX + CELL_PADDING) / cellSize) + 1, MAX_CELLS_PER_AXIS);
+	m_cellsY = std::min(u32((maxY - m_minY + CELL_PADDING) / cellSize) + 1, MAX_CELLS_PER_AXIS);
+	m_cellSize = std::max(cellSize, std::max(
+		(maxX - m_minX + CELL_PADDING) / m_cellsX,
+		(maxY - m_minY + CELL_PADDING) / m_cellsY
+	));
+
+	// Two passes: count references per cell, then fill (CSR layout)
+	const u32 cells = m_cellsX * m_cellsY;
+	m_cellStart.assign(cells + 1, 0);
+
+	std::vector<u32> covered;
+	for (auto&& seg : m_segments) {
+		cover(seg, covered);
+		for (u32 c : covered) m_cellStart[c + 1]++;
+	}
+
+	for (u32 i = 0; i < cells; i++) {
+		m_cellStart[i + 1] += m_cellStart[i];
+	}
+	m_refs.resize(m_cellStart[cells]);
+
+	std::vector<u32> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+	for (u32 i = 0; i < m_segments.size(); i++) {
+		cover(m_segments[i], covered);
+		for (u32 c : covered) m_refs[fill[c]++] = i;
+	}
+
+	m_stats.cellsX = m_cellsX;
+	m_stats.cellsY = m_cellsY;
+	m_stats.cellSize = m_cellSize;
+	m_stats.references = u32(m_refs.size());
+	m_stats.segments = u32(m_segments.size());
+	m_stats.buildMs = f64(SDL_GetPerformanceCounter() - start) * 1000.0 / f64(SDL_GetPerformanceFrequency());
+}
+
+void Grid::refit(const std::vector<Line>& lines, const std::vector<u32>& changed) {
+	std::vector<u32> before, after;
+	for (u32 l : changed) {
+		Segment seg;
+		seg.a = lines[l].a;
+		seg.b = lines[l].b;
+
+		// References are packed per cell, so a segment can only move in place
+		// while it covers the same cells (and stays inside the grid)
+		cover(m_segments[l], before);
+		cover(seg, after);
+		const f32 maxX = m_minX + m_cellsX * m_cellSize, maxY = m_minY + m_cellsY * m_cellSize;
+		const bool inside =
+			std::min(seg.a.x, seg.b.x) > m_minX + CELL_PADDING && std::max(seg.a.x, seg.b.x) < maxX - CELL_PADDING &&
+			std::min(seg.a.y, seg.b.y) > m_minY + CELL_PADDING && std::max(seg.a.y, seg.b.y) < maxY - CELL_PADDING;
+		if (!inside || before != after) {
+			build(lines, m_autoSize ? 0.0f : m_cellSize);
+			return;
+		}
+		m_segments[l] = seg;
+	}
+}
+
+void Grid::cover(const Segment& seg, std::vector<u32>& cells) const {
+	auto cell = [&](f32 v, f32 mn, u32 count) {
+		i32 c = i32(std::floor((v - mn) / m_cellSize));
+		return u32(std::min(std::max(c, 0), i32(count) - 1));
+	};
+	const u32 x0 = cell(std::min(seg.a.x, seg.b.x) - CELL_PADDING, m_minX, m_cellsX);
+	const u32 x1 = cell(std::max(seg.a.x, seg.b.x) + CELL_PADDING, m_minX, m_cellsX);
+	const u32 y0 = cell(std::min(seg.a.y, seg.b.y) - CELL_PADDING, m_minY, m_cellsY);
+	const u32 y1 = cell(std::max(seg.a.y, seg.b.y) + CELL_PADDING, m_minY, m_cellsY);
+
+	cells.clear();
+	for (u32 cy = y0; cy <= y1; cy++) {
+		for (u32 cx = x0; cx <= x1; cx++) {
+			if (overlaps(seg, cx, cy)) cells.push_back(cx + cy * m_cellsX);
+		}
+	}
+}
+
+bool Grid::overlaps(const Segment& seg, u32 cx, u32 cy) const {
+	const f32 x0 = m_minX + cx * m_cellSize - CELL_PADDING;
+	const f32 y0 = m_minY + cy * m_cellSize - CELL_PADDING;
+	const f32 x1 = x0 + m_cellSize + CELL_PADDING * 2.0f;
+	const f32 y1 = y0 + m_cellSize + CELL_PADDING * 2.0f;
+
+	// The caller only visits cells inside the segment's bounds, so the
+	// segment's line separating all four corners is the remaining case
+	const f32 dx = seg.b.x - seg.a.x, dy = seg.b.y - seg.a.y;
+	auto side = [&](f32 x, f32 y) {
+		return dx * (y - seg.a.y) - dy * (x - seg.a.x);
+	};
+	f32 s0 = side(x0, y0), s1 = side(x1, y0), s2 = side(x0, y1), s3 = side(x1, y1);
+	bool allPos = s0 > 0.0f && s1 > 0.0f && s2 > 0.0f && s3 > 0.0f;
+	bool allNeg = s0 < 0.0f && s1 < 0.0f && s2 < 0.0f && s3 < 0.0f;
+	return !(allPos || allNeg);
+}
+
+bool Grid::closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats) const {
+	ClosestHit q(tmax);
+	query(o, d, q, stats);
+	if (q.found) hit = q.hit;
+	return q.found;
+}
+
+template <typename Query>
+void Grid::query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	if (m_cellStart.empty()) return;
+
+	const f32 inf = std::numeric_limits<f32>::infinity();
+	const f32 invX = d.x != 0.0f ? 1.0f / d.x : inf;
+	const f32 invY = d.y != 0.0f ? 1.0f / d.y : inf;
+	const f32 maxX = m_minX + m_cellsX * m_cellSize;
+	const f32 maxY = m_minY + m_cellsY * m_cellSize;
+
+	// Clip the ray against the grid bounds
+	f32 tnear = 0.0f, tfar = q.limit();
+	if (d.x != 0.0f) {
+		f32 t1 = (m_minX - o.x) * invX, t2 = (maxX - o.x) * invX;
+		tnear = std::max(tnear, std::min(t1, t2));
+		tfar = std::min(tfar, std::max(t1, t2));
+	} else if (o.x < m_minX || o.x > maxX) {
+		return;
+	}
+	if (d.y != 0.0f) {
+		f32 t1 = (m_minY - o.y) * invY, t2 = (maxY - o.y) * invY;
+		tnear = std::max(tnear, std::min(t1, t2));
+		tfar = std::min(tfar, std::max(t1, t2));
+	} else if (o.y < m_minY || o.y > maxY) {
+		return;
+	}
+	if (tnear > tfar) return;
+
+	// Starting cell
+	const f32 px = o.x + d.x * tnear, py = o.y + d.y * tnear;
+	i32 cx = std::min(std::max(i32(std::floor((px - m_minX) / m_cellSize)), 0), i32(m_cellsX) - 1);
+	i32 cy = std::min(std::max(i32(std::floor((py - m_minY) / m_cellSize)), 0), i32(m_cellsY) - 1);
+
+	const i32 stepX = d.x > 0.0f ? 1 : -1;
+	const i32 stepY = d.y > 0.0f ? 1 : -1;
+	const f32 deltaX = std::fabs(m_cellSize * invX);
+	const f32 deltaY = std::fabs(m_cellSize * invY);
+	f32 nextX = d.x != 0.0f ? (m_minX + (cx + (stepX > 0 ? 1 : 0)) * m_cellSize - o.x) * invX : inf;
+	f32 nextY = d.y != 0.0f ? (m_minY + (cy + (stepY > 0 ? 1 : 0)) * m_cellSize - o.y) * invY : inf;
+
+	while (true) {
+		if (stats) stats->nodes++;
+
+		const u32 cell = u32(cx) + u32(cy) * m_cellsX;
+		for (u32 r = m_cellStart[cell]; r < m_cellStart[cell + 1]; r++) {
+			const u32 i = m_refs[r];
+			querySegment(q, i, o, d, m_segments[i].a, m_segments[i].b, stats);
+		}
+		if (q.done()) break;
+
+		// Anything closer than the query limit would have been in a visited cell
+		const f32 exit = std::min(nextX, nextY);
+		if (q.limit() <= exit) break;
+
+		if (nextX < nextY) {
+			cx += stepX;
+			if (cx < 0 || cx >= i32(m_cellsX)) break;
+			nextX += deltaX;
+		} else {
+			cy += stepY;
+			if (cy < 0 || cy >= i32(m_cellsY)) break;
+			nextY += deltaY;
+		}
+	}
+}
+
+template void Grid::query(const Vec3&, const Vec3&, ClosestHit&, RayStats*) const;
+template void Grid::query(const Vec3&, const Vec3&, AnyHit&, RayStats*) const;
+template void Grid::query(const Vec3&, const Vec3&, SortedHits&, RayStats*) const;
@@ -0,0 +1,53 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "world.h"
+#include "segment_query.h"
+
+#include <vector>
+
+// Uniform 2D grid of segment references over the world-space segments.
+// Rays walk it cell by cell with a DDA and stop at the first cell whose
+// exit is beyond the closest hit, instead of testing every segment.
+class Grid {
+public:
+	struct Stats {
+		u32 cellsX, cellsY, references, segments;
+		f32 cellSize;
+		f64 buildMs;
+	};
+
+	// cellSize <= 0 picks a size from the segment density, bounded by blockSize
+	void build(const std::vector<Line>& lines, f32 cellSize = 0.0f);
+	// Moves the changed lines in place, rebuilds if one of them changed cells
+	void refit(const std::vector<Line>& lines, const std::vector<u32>& changed);
+
+	// Closest hit with t < tmax. hit.index is the index into the lines it was built from.
+	bool closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats = nullptr) const;
+
+	// Feeds the hits along a ray to a ClosestHit, AnyHit or SortedHits query
+	template <typename Query>
+	void query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats = nullptr) const;
+
+	const Stats& stats() const { return m_stats; }
+	bool empty() const { return m_cellStart.empty(); }
+
+private:
+	struct Segment {
+		Vec3 a, b;
+	};
+
+	void cover(const Segment& seg, std::vector<u32>& cells) const;
+	bool overlaps(const Segment& seg, u32 cx, u32 cy) const;
+
+	f32 m_minX{ 0.0f }, m_minY{ 0.0f }, m_cellSize{ 1.0f };
+	u32 m_cellsX{ 0 }, m_cellsY{ 0 };
+	bool m_autoSize{ true };
+
+	std::vector<Segment> m_segments;
+	std::vector<u32> m_cellStart; // cellsX * cellsY + 1 offsets into m_refs
+	std::vector<u32> m_refs;
+	Stats m_stats{};
+};
+
+#endif // GRID_H
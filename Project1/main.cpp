@@ -1,454 +1,257 @@
 #include <iostream>
 
 #include "game_canvas.h"
-#include "stb_image.h"
+#include "raycast_game.h"
+#include "self_test.h"
 
+#include <cerrno>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
-#include <utility>
-#include <algorithm>
-#include <memory>
 
-#define rad(x) (x * 0.0174533f)
-
-struct Vec3 {
-	f32 x, y, z;
-
-	Vec3(f32 x, f32 y, f32 z) : x(x), y(y), z(z) {}
-	Vec3(f32 angle, f32 z = 0.0f) : x(std::cosf(angle)), y(std::sinf(angle)), z(z) {}
-	Vec3() : x(0.0f), y(0.0f), z(0.0f) {}
-
-	f32 dot(const Vec3& o) const { return x * o.x + y * o.y + z * o.z; }
-
-	Vec3 cross(const Vec3& o) const {
-		return Vec3(y * o.z - z * o.y,  z * o.x - x * o.z,  x * o.y - y * o.x);
-	}
-
-	f32 length() const { return std::sqrtf(dot(*this)); }
-	Vec3 normalized() const { return (*this) / length(); }
-	f32 angleZ() const { return std::atan2f(y, x); }
-
-	Vec3 rotateZ(f32 angle) const {
-		const float s = std::sinf(angle), c = std::cosf(angle);
-		f32 rx = x * c - y * s;
-		f32 ry = x * s + y * c;
-		return Vec3(rx, ry, z);
-	}
-
-	Vec3 lerp(const Vec3& to, f32 fac) const {
-		return (*this) * (1.0f - fac) + to * fac;
-	}
-
-	Vec3 operator +(const Vec3& o) const { return Vec3(x + o.x, y + o.y, z + o.z); }
-	Vec3 operator -(const Vec3& o) const { return Vec3(x - o.x, y - o.y, z - o.z); }
-	Vec3 operator *(const Vec3& o) const { return Vec3(x * o.x, y * o.y, z * o.z); }
-	Vec3 operator *(f32 o) const { return Vec3(x * o, y * o, z * o); }
-	Vec3 operator /(f32 o) const { return Vec3(x / o, y / o, z / o); }
-};
-
-struct Object {
-	Vec3 position{ 0.0f, 0.0f, 0.0f };
-	float rotation{ 0.0f };
-};
-
-struct Viewer : public Object {
-	float fov{ rad(60.0f) };
-};
-
-inline bool raySeg(
-	const Vec3& o, const Vec3& d, const Vec3& a, const Vec3& b,
-	Vec3& hit, Vec3& norm, float& t, float& u)
-{
-	Vec3 v1 = o - a;
-	Vec3 v2 = b - a;
-	Vec3 v3 = Vec3(-d.y, d.x, 0.0f);
-
-	f32 d23 = v2.dot(v3);
-	f32 t1 = v2.cross(v1).z / d23;
-	f32 t2 = v1.dot(v3) / d23;
-
-	if (t1 >= 0.0 && t2 >= 0.0 && t2 <= 1.0) {
-		hit = Vec3(a.x + v2.x * t2, a.y + v2.y * t2, 0.0f);
-		norm = Vec3(-v2.y, v2.x);
-		t = t1;
-		u = t2;
-		return true;
-	}
-	return false;
+static void usage(const char* exe) {
+	std::cerr << "Usage: " << exe << " [options]" << std::endl;
+	std::cerr << "  --headless            render offscreen, no window" << std::endl;
+	std::cerr << "  --frames N            frames to render in headless mode" << std::endl;
+	std::cerr << "  --dt S                fixed time step in headless mode" << std::endl;
+	std::cerr << "  --dump frame_%04d.png write every headless frame" << std::endl;
+	std::cerr << "  --bench               headless + per-stage timings (implies --path orbit)" << std::endl;
+	std::cerr << "  --selftest            check the optimized kernels against their reference and exit" << std::endl;
+	std::cerr << "  --path orbit|spin|zoom|file.csv" << std::endl;
+	std::cerr << "                        fly the viewer along a camera path" << std::endl;
+	std::cerr << "  --record file.csv     record the viewer path while playing" << std::endl;
+	std::cerr << "  --csv file.csv        write per-frame stage timings" << std::endl;
+	std::cerr << "  --json file.json      write stage timing summary" << std::endl;
+	std::cerr << "  --label name          label stored in the json summary" << std::endl;
+	std::cerr << "  --threads N           render threads (0 = one per core, 1 = no pool)" << std::endl;
+	std::cerr << "  --accel brute|bvh|grid|bsp|portal" << std::endl;
+	std::cerr << "                        segment acceleration structure" << std::endl;
+	std::cerr << "  --packet 4|8          trace adjacent columns as ray packets (bvh)," << std::endl;
+	std::cerr << "                        --bench also runs single rays for comparison" << std::endl;
+	std::cerr << "  --mip none|nearest|trilinear" << std::endl;
+	std::cerr << "                        mipmap filtering (default nearest)" << std::endl;
+	std::cerr << "  --size WxH            window size, rendered at half resolution (default 640x480)" << std::endl;
+	std::cerr << "  --target rows|columns framebuffer layout (default rows)" << std::endl;
+	std::cerr << "  --indexed             256-color palette, one byte per pixel" << std::endl;
+	std::cerr << "  --pack file.pak       write the textures and level to an asset pack and exit" << std::endl;
+	std::cerr << "  --assets file.pak     use the textures and level of an asset pack" << std::endl;
 }
 
-const f32 blockSize = 8.0f;
-const f32 maxDepth = 60.0f;
-
-class Texture {
-public:
-	Texture() = default;
-	~Texture() = default;
-
-	Texture(const std::string& fileName) {
-		i32 w, h, comp;
-		u8* data = stbi_load(fileName.c_str(), &w, &h, &comp, 3);
-		if (data) {
-			m_width = w;
-			m_height = h;
-			m_pixels = std::vector<u8>(data, data + (w * h * 3));
-			stbi_image_free(data);
-		}
-	}
-
-	inline Vec3 sample(f32 u, f32 v) {
-		u = u * m_width;
-		v = v * m_height;
-
-		u32 x = ::floor(u);
-		u32 y = ::floor(v);
-
-		f32 ur = u - x;
-		f32 vr = v - y;
-		f32 uo = 1.0f - ur;
-		f32 vo = 1.0f - vr;
-
-		Vec3 res =
-			(get(x, y) * uo + get(x + 1, y) * ur) * vo +
-			(get(x, y + 1) * uo + get(x + 1, y + 1) * ur) * vr;
-		return res;
-	}
-
-	inline Vec3 get(u32 x, u32 y) {
-		if (m_width == 0 || m_height == 0) return Vec3(1.0f, 0.0f, 1.0f);
-
-		x = x % m_width;
-		y = y % m_height;
-		u32 uvi = (x + y * m_width) * 3;
-		f32 r = f32(m_pixels[uvi + 0]) / 255.0f;
-		f32 g = f32(m_pixels[uvi + 1]) / 255.0f;
-		f32 b = f32(m_pixels[uvi + 2]) / 255.0f;
-		return Vec3(r, g, b);
-	}
-
-private:
-	u32 m_width{ 0 }, m_height{ 0 };
-	std::vector<u8> m_pixels;
-};
-
-struct Line {
-	Vec3 a, b;
-	f32 u0, u1;
-	Texture* texture{ nullptr };
-
-	inline float uv(float t) {
-		return (1.0f - t) * u0 + u1 * t;
-	}
-};
-
-struct HitInfo {
-	Line* line;
-	Vec3 position, normal;
-	f32 distance, u, length;
-};
-
-struct Model : public Object {
-	struct Vert {
-		Vec3 pos;
-		f32 u;
-	};
-
-	Texture texture;
-	std::vector<Vert> vertices;
-	std::vector<u32> indices;
-
-	inline void addVert(const Vec3& pos, f32 u) {
-		Vert v;
-		v.pos = pos;
-		v.u = u;
-		vertices.push_back(v);
-	}
-
-	inline void addIndex(u32 i) {
-		indices.push_back(i);
-	}
-
-	Model() : Object() {}
-	~Model() = default;
-};
-
-struct Block : public Model {
-	Block(f32 x, f32 y, f32 w, f32 h) : Model() {
-		position.x = x;
-		position.y = y;
-
-		const f32 u1 = w*2.0f;
-		const f32 u2 = h*2.0f;
-		addVert(Vec3(0, 0, 0), 0);
-		addVert(Vec3(w, 0, 0), u1);
-		addVert(Vec3(w, 0, 0), 0);
-		addVert(Vec3(w, h, 0), u2);
-		addVert(Vec3(w, h, 0), 0);
-		addVert(Vec3(0, h, 0), u1);
-		addVert(Vec3(0, h, 0), 0);
-		addVert(Vec3(0, 0, 0), u2);
-
-		addIndex(0);
-		addIndex(1);
-		addIndex(2);
-		addIndex(3);
-		addIndex(4);
-		addIndex(5);
-		addIndex(6);
-		addIndex(7);
-	}
-};
-
-struct Pillar : public Model {
-	Pillar(f32 x, f32 y, f32 radius) : Model() {
-		position.x = x;
-		position.y = y;
-
-		const u32 segments = 12;
-		const f32 step = (M_PI * 2.0f) / segments;
-		const f32 maxu = M_PI * 2.0f * radius;
-		const f32 ustep = maxu / (segments / 2.0f);
-
-		f32 u = 0.0f;
-		for (f32 a = 0.0f; a < M_PI * 2.0f; a += step) {
-			f32 cx = ::cosf(a) * radius;
-			f32 cy = ::sinf(a) * radius;
-			addVert(Vec3(cx + x, cy + y, 0.0f), u);
-			u += ustep;
-		}
-
-		for (u32 i = 0; i < segments-1; i++) {
-			addIndex(i);
-			addIndex(i + 1);
-		}
-		addIndex(0);
-		addIndex(segments - 1);
-	}
-};
-
-class RayCastGame : public GameAdapter {
-public:
-	void onSetup(GameCanvas *canvas) {
-		viewer.position = Vec3(8.0f, 8.0f, 0.0f);
-		viewer.fov = rad(90);
-
-		tfloor = Texture("floor.png");
-		tceil = Texture("ceiling.png");
-		twall = Texture("bricks.png");
-		tpillar = Texture("pillar.png");
-
-		Block* main = new Block(0, 0, 6, 6);
-		main->texture = twall;
-		add(main);
-
-		const u32 pillars = 16;
-		const f32 step = (M_PI * 2.0f) / pillars;
-		for (f32 r = 0.0f; r < M_PI * 2.0f; r += step) {
-			Pillar* pil = new Pillar(::cosf(r) + 1.5f, ::sinf(r) + 1.5f, 0.1f);
-			pil->texture = tpillar;
-			add(pil);
-		}
-	}
+// Whole-argument numbers, false for anything else (signs, trailing text, overflow)
+static bool parseU32(const char* str, u32& value) {
+	if (*str < '0' || *str > '9') return false;
+	char* end = nullptr;
+	errno = 0;
+	const unsigned long v = std::strtoul(str, &end, 10);
+	if (*end != '\0' || errno == ERANGE || v > 0xFFFFFFFFul) return false;
+	value = u32(v);
+	return true;
+}
 
-	void add(Model* model) {
-		models.push_back(std::unique_ptr<Model>(model));
-	}
+static bool parseF32(const char* str, f32& value) {
+	char* end = nullptr;
+	errno = 0;
+	const f32 v = std::strtof(str, &end);
+	if (end == str || *end != '\0' || errno == ERANGE || !std::isfinite(v)) return false;
+	value = v;
+	return true;
+}
 
-	void onUpdate(GameCanvas *canvas, f32 dt) {
-		if (canvas->isHeld(SDLK_x)) {
-			viewer.fov += dt;
-			if (viewer.fov >= rad(120)) {
-				viewer.fov = rad(120);
+int main(int argc, char** argv) {
+	bool headless = false, bench = false, columnMajor = false, indexed = false, test = false;
+	u32 frames = 300, threads = 0, packet = 0, width = 640, height = 480;
+	f32 dt = 1.0f / 60.0f;
+	std::string dumpPath = "", pathName = "", recordPath = "";
+	std::string csvPath = "", jsonPath = "", label = "";
+	std::string packOut = "", packIn = "";
+	Accel accel = Accel::BVH;
+	MipFilter mip = MipFilter::Nearest;
+
+	for (i32 i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--headless") {
+			headless = true;
+		} else if (arg == "--bench") {
+			headless = true;
+			bench = true;
+		} else if (arg == "--selftest") {
+			test = true;
+		} else if (arg == "--indexed") {
+			indexed = true;
+		} else if (arg == "--frames" && hasValue) {
+			const char* value = argv[++i];
+			if (!parseU32(value, frames)) {
+				std::cerr << "Invalid frame count: " << value << std::endl;
+				return 1;
 			}
-		} else if (canvas->isHeld(SDLK_z)) {
-			viewer.fov -= dt;
-			if (viewer.fov <= rad(20)) {
-				viewer.fov = rad(20);
+		} else if (arg == "--dt" && hasValue) {
+			const char* value = argv[++i];
+			if (!parseF32(value, dt)) {
+				std::cerr << "Invalid time step: " << value << std::endl;
+				return 1;
 			}
-		}
-
-		if (canvas->isHeld(SDLK_LEFT)) {
-			viewer.rotation -= dt * 1.8f;
-		} else if (canvas->isHeld(SDLK_RIGHT)) {
-			viewer.rotation += dt * 1.8f;
-		}
-
-		Vec3 dir(viewer.rotation);
-		if (canvas->isHeld(SDLK_UP)) {
-			Vec3 delta = dir * dt * 4.0f;
-			viewer.position = viewer.position + delta;
-			if (circleLines(viewer.position, 0.8f)) {
-				viewer.position = viewer.position - delta;
+		} else if (arg == "--dump" && hasValue) {
+			dumpPath = argv[++i];
+		} else if (arg == "--path" && hasValue) {
+			pathName = argv[++i];
+		} else if (arg == "--record" && hasValue) {
+			recordPath = argv[++i];
+		} else if (arg == "--csv" && hasValue) {
+			csvPath = argv[++i];
+		} else if (arg == "--json" && hasValue) {
+			jsonPath = argv[++i];
+		} else if (arg == "--label" && hasValue) {
+			label = argv[++i];
+		} else if (arg == "--threads" && hasValue) {
+			const char* value = argv[++i];
+			if (!parseU32(value, threads)) {
+				std::cerr << "Invalid thread count: " << value << std::endl;
+				return 1;
 			}
-		} else if (canvas->isHeld(SDLK_DOWN)) {
-			Vec3 delta = dir * dt * 4.0f;
-			viewer.position = viewer.position - delta;
-			if (circleLines(viewer.position, 0.8f)) {
-				viewer.position = viewer.position + delta;
+		} else if (arg == "--packet" && hasValue) {
+			const char* value = argv[++i];
+			if (!parseU32(value, packet)) {
+				std::cerr << "Invalid packet size: " << value << std::endl;
+				return 1;
 			}
-		}
-	}
-
-	void onDraw(GameCanvas *canvas) {
-		// Create lines
-		lines.clear();
-		for (auto&& model : models) {
-			for (u32 i = 0; i < model->indices.size(); i += 2) {
-				Model::Vert va = model->vertices[model->indices[i + 0]];
-				Model::Vert vb = model->vertices[model->indices[i + 1]];
-				Line ln;
-				ln.a = va.pos + model->position;
-				ln.b = vb.pos + model->position;
-				ln.u0 = va.u;
-				ln.u1 = vb.u;
-				ln.texture = &model->texture;
-				lines.push_back(ln);
+		} else if (arg == "--accel" && hasValue) {
+			std::string name = argv[++i];
+			if (name == "brute") {
+				accel = Accel::Brute;
+			} else if (name == "bvh") {
+				accel = Accel::BVH;
+			} else if (name == "grid") {
+				accel = Accel::Grid;
+			} else if (name == "bsp") {
+				accel = Accel::BSP;
+			} else if (name == "portal") {
+				accel = Accel::Portal;
+			} else {
+				std::cerr << "Unknown acceleration structure: " << name << std::endl;
+				return 1;
 			}
-		}
-
-		// Render
-		canvas->clear();
-
-		const f32 w2 = canvas->width() / 2;
-		const f32 h2 = canvas->height() / 2;
-		
-		const f32 thf = ::tanf(viewer.fov / 2.0f);
-		const f32 planeDist = w2 / thf;
-		Vec3 plane(
-			0.0f,
-			thf,
-			0.0f
-		);
-		plane = plane.rotateZ(viewer.rotation);
-
-		for (u32 x = 0; x < canvas->width(); x++) {
-			// Calculate the angle of the ray
-			const f32 xf = (f32(x) / f32(canvas->width())) * 2.0f - 1.0f;
-
-			Vec3 rayPos = viewer.position;
-			Vec3 rayDir(
-				::cosf(viewer.rotation) + plane.x * xf,
-				::sinf(viewer.rotation) + plane.y * xf,
-				0.0f
-			);
-
-			HitInfo info;
-			if (rayLines(rayPos, rayDir, info) && info.distance < maxDepth) {
-				const f32 d = info.distance * thf;
-				const f32 ceil = h2 - f32(canvas->height()) / d;
-				const f32 floor = canvas->height() - ceil;
-				const f32 wh = floor - ceil;
-
-				f32 fog = 1.0f - (d / maxDepth);
-				for (u32 y = 0; y < canvas->height(); y++) {
-					f32 fwx = info.position.x;
-					f32 fwy = info.position.y;
-
-					if (y <= ceil) {
-						f32 dist = f32(canvas->height()) / ((canvas->height() - y) - h2);
-						f32 we = (dist / d);
-						f32 cfog = std::min(((h2 - y) / maxDepth), 1.0f);
-
-						f32 fu = (we * fwx + (1.0f - we) * viewer.position.x) / 2.0f;
-						f32 fv = (we * fwy + (1.0f - we) * viewer.position.y) / 2.0f;
-
-						Vec3 c = tceil.sample(fu, fv) * cfog;
-						canvas->put(x, y, c.x, c.y, c.z);
-					} else if (y > ceil && y <= floor) {
-						f32 u = info.line->uv(info.u);
-						f32 v = f32(y - ceil) / wh;
-						
-						Vec3 c = info.line->texture->sample(u, v) * fog;
-						canvas->put(x, y, c.x, c.y, c.z);
-					} else { // Floor
-						f32 u = info.line->uv(info.u);
-						f32 v = f32(y - floor) / wh;
-
-						f32 dist = f32(canvas->height()) / (y - h2);
-						f32 we = (dist / d);
-						f32 cfog = std::min(((y - h2) / maxDepth), 1.0f);
-
-						f32 fu = (we * fwx + (1.0f - we) * viewer.position.x) / 2.0f;
-						f32 fv = (we * fwy + (1.0f - we) * viewer.position.y) / 2.0f;
-
-						Vec3 c = tfloor.sample(fu, fv) * cfog;
-						if (v < 1.0f) {
-							f32 mixFac = (1.0f - v) * we;
-							Vec3 t = info.line->texture->sample(u, 1.0f - v) * fog * cfog;
-							c = c + t * mixFac;
-						}
-						canvas->put(x, y, c.x, c.y, c.z);
-					}
-				}
+		} else if (arg == "--pack" && hasValue) {
+			packOut = argv[++i];
+		} else if (arg == "--assets" && hasValue) {
+			packIn = argv[++i];
+		} else if (arg == "--mip" && hasValue) {
+			std::string name = argv[++i];
+			if (name == "none") {
+				mip = MipFilter::None;
+			} else if (name == "nearest") {
+				mip = MipFilter::Nearest;
+			} else if (name == "trilinear") {
+				mip = MipFilter::Trilinear;
+			} else {
+				std::cerr << "Unknown mip filter: " << name << std::endl;
+				return 1;
 			}
+		} else if (arg == "--size" && hasValue) {
+			std::string size = argv[++i];
+			if (std::sscanf(size.c_str(), "%ux%u", &width, &height) != 2 || width < 2 || height < 2) {
+				std::cerr << "Invalid size: " << size << std::endl;
+				return 1;
+			}
+		} else if (arg == "--target" && hasValue) {
+			std::string name = argv[++i];
+			if (name == "rows") {
+				columnMajor = false;
+			} else if (name == "columns") {
+				columnMajor = true;
+			} else {
+				std::cerr << "Unknown target: " << name << std::endl;
+				return 1;
+			}
+		} else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			usage(argv[0]);
+			return 1;
 		}
-
-		canvas->str("X: " + std::to_string(viewer.position.x), 5, 5);
-		canvas->str("Y: " + std::to_string(viewer.position.y), 5, 13);
 	}
 
-	Vec3 closestPoint(const Vec3& a, const Vec3& b, const Vec3& p, f32& t) {
-		Vec3 ap = p - a;
-		Vec3 ab = b - a;
-		f32 atb = ab.dot(ab);
-		f32 apab = ap.dot(ab);
-		t = apab / atb;
-		return a + ab * t;
+	if (test) {
+		return selfTest() ? 0 : 1;
 	}
 
-	bool circleLines(const Vec3& o, f32 radius) {
-		for (auto&& line : lines) {
-			f32 t;
-			Vec3 p = closestPoint(line.a * blockSize, line.b * blockSize, o, t);
-			if (t >= 0.0f && t <= 1.0f) {
-				f32 d = (p - o).length();
-				if (d < radius) {
-					return true;
-				}
-			}
+	// Offline: decode everything once and store it ready to map
+	if (!packOut.empty()) {
+		RayCastGame packer;
+		packer.threads = 1;
+		packer.packPath = packIn;
+		packer.onSetup(nullptr);
+		if (!AssetPack::write(packOut, packer.textures, packer.models, packer.sectorPolygons)) {
+			std::cerr << "Could not write asset pack: " << packOut << std::endl;
+			return 1;
 		}
-		return false;
+		std::cerr << "Packed " << packer.textures.stats().textures << " textures, " << packer.models.size()
+			<< " models and " << packer.sectorPolygons.size() << " sectors into " << packOut << std::endl;
+		return 0;
 	}
 
-	bool rayLines(const Vec3& o, const Vec3& d, HitInfo& info) {
-		using IDist = std::pair<u32, HitInfo>;
-		std::vector<IDist> md;
-		for (u32 i = 0; i < lines.size(); i++) {
-			Vec3 hitPos, hitNorm;
-			f32 dist, u;
-			Vec3 a = lines[i].a * blockSize, b = lines[i].b * blockSize;
-			if (raySeg(o, d, a, b, hitPos, hitNorm, dist, u)) {
-				HitInfo hi;
-				hi.distance = dist;
-				hi.position = hitPos;
-				hi.normal = hitNorm;
-				hi.length = (b - a).length() / blockSize * 2.0f;
-				hi.u = u;
-				hi.line = &lines[i];
-				md.push_back(std::make_pair(i, hi));
-			}
-		}
+	if (bench && pathName.empty()) {
+		pathName = "orbit";
+	}
 
-		std::sort(md.begin(), md.end(), [](const IDist& a, const IDist& b) {
-			return a.second.distance < b.second.distance;
-		});
+	CameraPath path, recording;
+	if (!pathName.empty() && !CameraPath::fromName(pathName, path)) {
+		std::cerr << "Could not load camera path: " << pathName << std::endl;
+		return 1;
+	}
 
-		if (!md.empty()) {
-			info = md[0].second;
-			return true;
-		}
-		return false;
+	RayCastGame* game = new RayCastGame();
+	game->threads = threads;
+	game->accel = accel;
+	game->packetSize = packet;
+	game->mipFilter = mip;
+	game->indexedColor = indexed;
+	// Redrawing a still scene only matters in a window, headless runs time every frame
+	game->skipStill = !headless;
+	game->packPath = packIn;
+	if (!path.empty()) game->path = &path;
+	if (!recordPath.empty()) game->recording = &recording;
+
+	GameCanvas gc{ game, width, height, 2, headless };
+	gc.setColumnMajor(columnMajor);
+	gc.profiler().enable(bench || !csvPath.empty() || !jsonPath.empty());
+
+	i32 ret = headless ? gc.runHeadless(frames, dt, dumpPath) : gc.run();
+	if (gc.profiler().enabled()) {
+		game->printStats();
 	}
 
-	Viewer viewer{};
+	// Same run with one ray per column, to report the packet speedup
+	if (bench && packet > 1 && accel == Accel::BVH) {
+		RayCastGame* single = new RayCastGame();
+		single->threads = threads;
+		single->accel = accel;
+		single->mipFilter = mip;
+		single->indexedColor = indexed;
+		single->packPath = packIn;
+		if (!path.empty()) single->path = &path;
+
+		std::cerr << "Single-ray run for comparison:" << std::endl;
+		GameCanvas sc{ single, width, height, 2, true };
+		sc.setColumnMajor(columnMajor);
+		sc.profiler().enable(true);
+		sc.runHeadless(frames, dt, "");
+
+		const f64 packetMs = gc.profiler().stats(Stage::Rays).mean;
+		const f64 singleMs = sc.profiler().stats(Stage::Rays).mean;
+		std::cerr << "Rays: " << packetMs << " ms with packets of " << packet << ", " << singleMs
+			<< " ms per column (" << (packetMs > 0.0 ? singleMs / packetMs : 0.0) << "x)" << std::endl;
+	}
 
-	std::vector<std::unique_ptr<Model>> models;
-	std::vector<Line> lines;
-	
-	Texture twall, tfloor, tceil, tpillar;
-};
+	if (!recordPath.empty() && !recording.save(recordPath)) {
+		std::cerr << "Could not write " << recordPath << std::endl;
+	}
+	if (!csvPath.empty() && !gc.profiler().writeCSV(csvPath)) {
+		std::cerr << "Could not write " << csvPath << std::endl;
+	}
+	if (!jsonPath.empty() && !gc.profiler().writeJSON(jsonPath, label)) {
+		std::cerr << "Could not write " << jsonPath << std::endl;
+	}
 
-int main(int argc, char** argv) {
-	GameCanvas gc{ new RayCastGame(), 640, 480 };
-	return gc.run();
-}
\ No newline at end of file
+	return ret;
+}
@@ -0,0 +1,161 @@
+#include "palette.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+	const u32 CELLS = 32; // per channel
+
+	u32 cell(u32 r, u32 g, u32 b) { return r | (g << 5) | (b << 10); }
+
+	// Box of histogram cells, bounds inclusive
+	struct Box {
+		u32 lo[3], hi[3];
+		u64 count;
+	};
+
+	u32 distance2(u32 a, u32 b) {
+		const i32 dr = i32(red(a)) - i32(red(b)), dg = i32(green(a)) - i32(green(b)), db = i32(blue(a)) - i32(blue(b));
+		return u32(dr * dr + dg * dg + db * db);
+	}
+}
+
+void Palette::build(const TextureCache& textures) {
+	// Histogram of the full-size texels at 5 bits per channel, with the color sums of each cell
+	std::vector<u32> count(CELLS * CELLS * CELLS, 0);
+	std::vector<u64> sum(count.size() * 3, 0);
+	std::unordered_set<const Texture*> seen;
+	for (TextureHandle h = 0; h < textures.size(); h++) {
+		const Texture& tex = textures.get(h);
+		if (tex.empty() || !seen.insert(&tex).second) continue;
+		const u32* texels = tex.data();
+		for (u32 i = 0; i < tex.width() * tex.height(); i++) {
+			const u32 c = texels[i];
+			const u32 k = cell(red(c) >> 3, green(c) >> 3, blue(c) >> 3);
+			count[k]++;
+			sum[k * 3 + 0] += red(c);
+			sum[k * 3 + 1] += green(c);
+			sum[k * 3 + 2] += blue(c);
+		}
+	}
+
+	auto forCells = [&](const Box& b, auto&& fn) {
+		for (u32 z = b.lo[2]; z <= b.hi[2]; z++)
+			for (u32 y = b.lo[1]; y <= b.hi[1]; y++)
+				for (u32 x = b.lo[0]; x <= b.hi[0]; x++) fn(x, y, z, cell(x, y, z));
+	};
+	// Tightens a box around its non-empty cells
+	auto shrink = [&](Box& b) {
+		Box t{ { CELLS, CELLS, CELLS }, { 0, 0, 0 }, 0 };
+		forCells(b, [&](u32 x, u32 y, u32 z, u32 k) {
+			if (count[k] == 0) return;
+			const u32 p[3] = { x, y, z };
+			for (u32 a = 0; a < 3; a++) {
+				t.lo[a] = std::min(t.lo[a], p[a]);
+				t.hi[a] = std::max(t.hi[a], p[a]);
+			}
+			t.count += count[k];
+		});
+		if (t.count > 0) b = t;
+		else b.count = 0;
+	};
+
+	// Median cut: split the box with the most texels times its longest side
+	// at the median of that side, until the free entries are used up
+	const u32 free = size - 3;
+	std::vector<Box> boxes;
+	Box all{ { 0, 0, 0 }, { CELLS - 1, CELLS - 1, CELLS - 1 }, 0 };
+	shrink(all);
+	if (all.count > 0) boxes.push_back(all);
+
+	while (boxes.size() < free) {
+		u32 best = u32(boxes.size()), axis = 0;
+		u64 bestScore = 0;
+		for (u32 i = 0; i < boxes.size(); i++) {
+			const Box& b = boxes[i];
+			u32 side = 0, a = 0;
+			for (u32 j = 0; j < 3; j++) {
+				if (b.hi[j] - b.lo[j] > side) { side = b.hi[j] - b.lo[j]; a = j; }
+			}
+			if (side > 0 && b.count * side > bestScore) {
+				bestScore = b.count * side;
+				best = i;
+				axis = a;
+			}
+		}
+		if (best == boxes.size()) break; // every box is a single cell
+
+		Box b = boxes[best];
+		std::vector<u64> slice(CELLS, 0);
+		forCells(b, [&](u32 x, u32 y, u32 z, u32 k) {
+			const u32 p[3] = { x, y, z };
+			slice[p[axis]] += count[k];
+		});
+		u32 split = b.lo[axis];
+		for (u64 acc = 0; split < b.hi[axis] - 1; split++) {
+			acc += slice[split];
+			if (acc * 2 >= b.count) break;
+		}
+
+		Box lo = b, hi = b;
+		lo.hi[axis] = split;
+		hi.lo[axis] = split + 1;
+		shrink(lo);
+		shrink(hi);
+		boxes[best] = lo;
+		boxes.push_back(hi);
+	}
+
+	// Reserved entries, then the mean color of each box
+	std::fill(m_colors, m_colors + size, 0u);
+	m_colors[black] = packRGB(0, 0, 0);
+	m_colors[missing] = packRGB(255, 0, 255);
+	m_colors[white] = packRGB(255, 255, 255);
+	for (u32 i = 0; i < boxes.size(); i++) {
+		u64 r = 0, g = 0, bl = 0, n = 0;
+		forCells(boxes[i], [&](u32, u32, u32, u32 k) {
+			r += sum[k * 3 + 0];
+			g += sum[k * 3 + 1];
+			bl += sum[k * 3 + 2];
+			n += count[k];
+		});
+		if (n > 0) m_colors[2 + i] = packRGB(u32(r / n), u32(g / n), u32(bl / n));
+	}
+
+	// Nearest entry of every cell center
+	m_inverse.resize(CELLS * CELLS * CELLS);
+	for (u32 b = 0; b < CELLS; b++)
+		for (u32 g = 0; g < CELLS; g++)
+			for (u32 r = 0; r < CELLS; r++) {
+				m_inverse[cell(r, g, b)] = search(packRGB(r << 3 | 4, g << 3 | 4, b << 3 | 4));
+			}
+
+	for (u32 l = 0; l < levels; l++) {
+		for (u32 i = 0; i < size; i++) m_colormap[l][i] = search(shade(m_colors[i], std::min(l * 8, 256u)));
+	}
+
+	m_add.resize(size * size);
+	for (u32 a = 0; a < size; a++) {
+		for (u32 b = 0; b < size; b++) m_add[(a << 8) | b] = nearest(addSat(m_colors[a], m_colors[b]));
+	}
+}
+
+std::vector<u8> Palette::quantize(const Texture& texture) const {
+	std::vector<u8> indices(texture.texelCount());
+	const u32* texels = texture.data();
+	for (u32 i = 0; i < indices.size(); i++) indices[i] = nearest(texels[i]);
+	return indices;
+}
+
+u8 Palette::search(u32 rgb) const {
+	u32 best = 0, bestDist = 0xFFFFFFFF;
+	for (u32 i = 0; i < size; i++) {
+		// Unused entries (fewer colors than the palette holds) stay black and never win over index 0
+		const u32 d = distance2(rgb, m_colors[i]);
+		if (d < bestDist) {
+			bestDist = d;
+			best = i;
+		}
+	}
+	return u8(best);
+}
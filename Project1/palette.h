@@ -0,0 +1,48 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include "texture_cache.h"
+
+#include <vector>
+
+// 256 colors for the indexed render mode, with the tables that stand in for
+// arithmetic on colors once pixels are palette indices: a colormap per light
+// level (as in Doom) and a saturated-add map for the floor reflections.
+class Palette {
+public:
+	static const u32 size = 256;
+	// Reserved entries, the other 253 come from the textures
+	static const u8 black = 0, missing = 1, white = 255;
+	// Shade factors (8.8, see fixedShade) are mapped to this many levels
+	static const u32 levels = 33;
+
+	// Median cut over the full-size texels of every texture in the cache
+	void build(const TextureCache& textures);
+	bool empty() const { return m_inverse.empty(); }
+
+	const u32* colors() const { return m_colors; }
+	u32 color(u8 index) const { return m_colors[index]; }
+
+	// Closest entry, looked up at 5 bits per channel
+	u8 nearest(u32 rgb) const {
+		return m_inverse[((rgb >> 3) & 0x1F) | ((rgb >> 6) & 0x3E0) | ((rgb >> 9) & 0x7C00)];
+	}
+	// Indices of all texels of a texture, in its storage order
+	std::vector<u8> quantize(const Texture& texture) const;
+
+	// Index of every color scaled by the 8.8 factor f
+	const u8* level(u32 f) const { return m_colormap[f >> 3]; }
+	// Index of the per-channel saturated sum of two colors
+	u8 add(u8 a, u8 b) const { return m_add[(u32(a) << 8) | b]; }
+
+private:
+	// Exact search, for building the tables
+	u8 search(u32 rgb) const;
+
+	u32 m_colors[size]{};
+	std::vector<u8> m_inverse; // 32x32x32 cells
+	u8 m_colormap[levels][size]{};
+	std::vector<u8> m_add; // 256x256
+};
+
+#endif // PALETTE_H
@@ -0,0 +1,136 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include "integer.h"
+#include "simd.h"
+
+// Packed pixels hold R in the low byte, then G and B (0x00BBGGRR), which is
+// the framebuffer's byte order on little-endian machines.
+// Shade factors are 8.8 fixed point: 256 is 1.0.
+
+inline u32 packRGB(u32 r, u32 g, u32 b) {
+	return r | (g << 8) | (b << 16);
+}
+
+inline u32 red(u32 c) { return c & 0xFF; }
+inline u32 green(u32 c) { return (c >> 8) & 0xFF; }
+inline u32 blue(u32 c) { return (c >> 16) & 0xFF; }
+
+// Float factor to 8.8, clamped to [0, 1]
+inline u32 fixedShade(f32 f) {
+	return f <= 0.0f ? 0 : f >= 1.0f ? 256 : u32(f * 256.0f);
+}
+
+// Multiplies all channels by an 8.8 factor <= 256
+inline u32 shade(u32 c, u32 f) {
+	const u32 rb = ((c & 0xFF00FF) * f >> 8) & 0xFF00FF;
+	const u32 g = ((c & 0x00FF00) * f >> 8) & 0x00FF00;
+	return rb | g;
+}
+
+// Per-channel add, saturating at 255
+inline u32 addSat(u32 a, u32 b) {
+	const u32 r = red(a) + red(b), g = green(a) + green(b), bl = blue(a) + blue(b);
+	return packRGB(r > 255 ? 255 : r, g > 255 ? 255 : g, bl > 255 ? 255 : bl);
+}
+
+// Per-channel a + (b - a) * f for an 8.8 factor <= 256, rounded
+inline u32 lerpRGB(u32 a, u32 b, u32 f) {
+	const u32 rb = ((a & 0xFF00FF) * (256 - f) + (b & 0xFF00FF) * f + 0x800080) >> 8;
+	const u32 g = ((a & 0x00FF00) * (256 - f) + (b & 0x00FF00) * f + 0x008000) >> 8;
+	return (rb & 0xFF00FF) | (g & 0x00FF00);
+}
+
+// Per-channel rounded average of four pixels
+inline u32 averageRGB(u32 a, u32 b, u32 c, u32 d) {
+	const u32 rb = ((a & 0xFF00FF) + (b & 0xFF00FF) + (c & 0xFF00FF) + (d & 0xFF00FF) + 0x020002) >> 2;
+	const u32 g = ((a & 0x00FF00) + (b & 0x00FF00) + (c & 0x00FF00) + (d & 0x00FF00) + 0x000200) >> 2;
+	return (rb & 0xFF00FF) | (g & 0x00FF00);
+}
+
+// Sets n pixels to c
+inline void fillRGB(u32* p, u32 n, u32 c) {
+	u32 i = 0;
+#if defined(SIMD_AVX)
+	const __m256i c8 = _mm256_set1_epi32(i32(c));
+	for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*) (p + i), c8);
+#endif
+#if defined(SIMD_SSE)
+	const __m128i c4 = _mm_set1_epi32(i32(c));
+	for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*) (p + i), c4);
+#endif
+	for (; i < n; i++) p[i] = c;
+}
+
+// Sets the pixels whose mask is all ones to c, keeps those whose mask is zero
+inline void blendRGB(u32* p, const u32* mask, u32 n, u32 c) {
+	u32 i = 0;
+#if defined(SIMD_SSE)
+	const __m128i c4 = _mm_set1_epi32(i32(c));
+	for (; i + 4 <= n; i += 4) {
+		const __m128i m = _mm_loadu_si128((const __m128i*) (mask + i));
+		const __m128i d = _mm_loadu_si128((const __m128i*) (p + i));
+		_mm_storeu_si128((__m128i*) (p + i), _mm_or_si128(_mm_andnot_si128(m, d), _mm_and_si128(m, c4)));
+	}
+#endif
+	for (; i < n; i++) p[i] = (p[i] & ~mask[i]) | (c & mask[i]);
+}
+
+// Looks up n palette indices, 8 at a time with AVX2 gathers. SSE2 has no
+// gather, there the lookups stay scalar and the stores go 4 pixels at a time.
+inline void expandRGB(u32* dst, const u8* src, u32 n, const u32* palette) {
+	u32 i = 0;
+#if defined(SIMD_AVX2)
+	for (; i + 8 <= n; i += 8) {
+		const __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (src + i)));
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_i32gather_epi32((const int*) palette, idx, 4));
+	}
+#endif
+#if defined(SIMD_SSE)
+	for (; i + 4 <= n; i += 4) {
+		const __m128i c4 = _mm_set_epi32(i32(palette[src[i + 3]]), i32(palette[src[i + 2]]), i32(palette[src[i + 1]]), i32(palette[src[i]]));
+		_mm_storeu_si128((__m128i*) (dst + i), c4);
+	}
+#endif
+	for (; i < n; i++) dst[i] = palette[src[i]];
+}
+
+// Copies a w x h block stored in columns (srcPitch apart) into rows (dstPitch
+// apart), in tiles small enough for both sides to stay in L1, 4x4 pixels at a time
+inline void transposeRGB(const u32* src, u32 srcPitch, u32* dst, u32 dstPitch, u32 w, u32 h) {
+	const u32 tile = 32;
+	for (u32 tx = 0; tx < w; tx += tile) {
+		for (u32 ty = 0; ty < h; ty += tile) {
+			const u32 x1 = tx + (w - tx < tile ? w - tx : tile);
+			const u32 y1 = ty + (h - ty < tile ? h - ty : tile);
+			u32 x = tx;
+#if defined(SIMD_SSE)
+			for (; x + 4 <= x1; x += 4) {
+				u32 y = ty;
+				for (; y + 4 <= y1; y += 4) {
+					const u32* s = src + x * srcPitch + y;
+					const __m128i c0 = _mm_loadu_si128((const __m128i*) s);
+					const __m128i c1 = _mm_loadu_si128((const __m128i*) (s + srcPitch));
+					const __m128i c2 = _mm_loadu_si128((const __m128i*) (s + srcPitch * 2));
+					const __m128i c3 = _mm_loadu_si128((const __m128i*) (s + srcPitch * 3));
+					const __m128i t0 = _mm_unpacklo_epi32(c0, c1), t1 = _mm_unpacklo_epi32(c2, c3);
+					const __m128i t2 = _mm_unpackhi_epi32(c0, c1), t3 = _mm_unpackhi_epi32(c2, c3);
+					u32* d = dst + y * dstPitch + x;
+					_mm_storeu_si128((__m128i*) d, _mm_unpacklo_epi64(t0, t1));
+					_mm_storeu_si128((__m128i*) (d + dstPitch), _mm_unpackhi_epi64(t0, t1));
+					_mm_storeu_si128((__m128i*) (d + dstPitch * 2), _mm_unpacklo_epi64(t2, t3));
+					_mm_storeu_si128((__m128i*) (d + dstPitch * 3), _mm_unpackhi_epi64(t2, t3));
+				}
+				for (; y < y1; y++) {
+					for (u32 i = 0; i < 4; i++) dst[y * dstPitch + x + i] = src[(x + i) * srcPitch + y];
+				}
+			}
+#endif
+			for (; x < x1; x++) {
+				for (u32 y = ty; y < y1; y++) dst[y * dstPitch + x] = src[x * srcPitch + y];
+			}
+		}
+	}
+}
+
+#endif // PIXEL_H
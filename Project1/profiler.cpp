@@ -0,0 +1,204 @@
+#include "profiler.h"
+
+#include "SDL.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+static const char* STAGE_NAMES[] = {
+	"lines", "accel", "rays", "walls", "flats", "hud", "present"
+};
+
+static const char* COUNTER_NAMES[] = {
+	"rays", "nodes", "tests", "fallbacks"
+};
+
+// JSON string contents: quotes and backslashes escaped, control characters as \u00XX
+static std::string jsonEscape(const std::string& str) {
+	std::string out;
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (u8(c) < 0x20) {
+			char code[8];
+			std::snprintf(code, sizeof(code), "\\u%04x", u32(u8(c)));
+			out += code;
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
+
+const char* Profiler::stageName(Stage stage) {
+	if (stage >= Stage::Count) return "frame";
+	return STAGE_NAMES[u32(stage)];
+}
+
+const char* Profiler::counterName(Counter counter) {
+	if (counter >= Counter::Count) return "";
+	return COUNTER_NAMES[u32(counter)];
+}
+
+u64 Profiler::now() const {
+	if (!m_enabled) return 0;
+	return SDL_GetPerformanceCounter();
+}
+
+void Profiler::add(Stage stage, u64 since) {
+	if (!m_enabled) return;
+	m_current[u32(stage)].fetch_add(SDL_GetPerformanceCounter() - since, std::memory_order_relaxed);
+}
+
+void Profiler::count(Counter counter, u64 amount) {
+	if (!m_enabled) return;
+	m_counters[u32(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void Profiler::beginFrame() {
+	if (!m_enabled) return;
+	for (auto&& v : m_current) v.store(0, std::memory_order_relaxed);
+	for (auto&& v : m_counters) v.store(0, std::memory_order_relaxed);
+	m_frameStart = SDL_GetPerformanceCounter();
+}
+
+void Profiler::endFrame() {
+	if (!m_enabled) return;
+	const f64 toMs = 1000.0 / f64(SDL_GetPerformanceFrequency());
+
+	Frame frame;
+	frame.total = f64(SDL_GetPerformanceCounter() - m_frameStart) * toMs;
+	for (u32 i = 0; i < u32(Stage::Count); i++) {
+		frame.stages[i] = f64(m_current[i].load(std::memory_order_relaxed)) * toMs;
+	}
+	for (u32 i = 0; i < u32(Counter::Count); i++) {
+		frame.counters[i] = m_counters[i].load(std::memory_order_relaxed);
+	}
+	m_frames.push_back(frame);
+}
+
+Profiler::Stats Profiler::stats(Stage stage) const {
+	Stats st{ 0.0, 0.0, 0.0, 0.0 };
+	if (m_frames.empty()) return st;
+
+	std::vector<f64> values;
+	values.reserve(m_frames.size());
+	for (auto&& frame : m_frames) {
+		values.push_back(stage >= Stage::Count ? frame.total : frame.stages[u32(stage)]);
+	}
+	std::sort(values.begin(), values.end());
+
+	// Nearest-rank percentiles
+	auto rank = [&](f64 p) {
+		u32 i = u32(p * values.size() + 0.5);
+		i = i > 0 ? i - 1 : 0;
+		return values[std::min(i, u32(values.size() - 1))];
+	};
+
+	for (f64 v : values) st.mean += v;
+	st.mean /= values.size();
+	st.p50 = rank(0.50);
+	st.p99 = rank(0.99);
+	st.max = values.back();
+	return st;
+}
+
+f64 Profiler::counterMean(Counter counter) const {
+	if (m_frames.empty()) return 0.0;
+	f64 sum = 0.0;
+	for (auto&& frame : m_frames) {
+		sum += f64(frame.counters[u32(counter)]);
+	}
+	return sum / m_frames.size();
+}
+
+bool Profiler::writeCSV(const std::string& fileName) const {
+	std::ofstream out(fileName);
+	if (!out) return false;
+
+	out << "frame,total";
+	for (u32 i = 0; i < u32(Stage::Count); i++) {
+		out << "," << stageName(Stage(i));
+	}
+	for (u32 i = 0; i < u32(Counter::Count); i++) {
+		out << "," << counterName(Counter(i));
+	}
+	out << "\n";
+
+	for (u32 f = 0; f < m_frames.size(); f++) {
+		out << f << "," << m_frames[f].total;
+		for (u32 i = 0; i < u32(Stage::Count); i++) {
+			out << "," << m_frames[f].stages[i];
+		}
+		for (u32 i = 0; i < u32(Counter::Count); i++) {
+			out << "," << m_frames[f].counters[i];
+		}
+		out << "\n";
+	}
+	return bool(out);
+}
+
+bool Profiler::writeJSON(const std::string& fileName, const std::string& label) const {
+	std::ofstream out(fileName);
+	if (!out) return false;
+
+	auto writeStats = [&](Stage stage) {
+		Stats st = stats(stage);
+		out << "\"" << stageName(stage) << "\": { "
+			<< "\"mean\": " << st.mean << ", "
+			<< "\"p50\": " << st.p50 << ", "
+			<< "\"p99\": " << st.p99 << ", "
+			<< "\"max\": " << st.max << " }";
+	};
+
+	out << "{\n";
+	out << "\t\"label\": \"" << jsonEscape(label) << "\",\n";
+	out << "\t\"frames\": " << m_frames.size() << ",\n";
+	out << "\t\"unit\": \"ms\",\n";
+	out << "\t";
+	writeStats(Stage::Count);
+	out << ",\n";
+	out << "\t\"stages\": {\n";
+	for (u32 i = 0; i < u32(Stage::Count); i++) {
+		out << "\t\t";
+		writeStats(Stage(i));
+		out << (i + 1 < u32(Stage::Count) ? ",\n" : "\n");
+	}
+	out << "\t},\n";
+	out << "\t\"counters\": {\n";
+	for (u32 i = 0; i < u32(Counter::Count); i++) {
+		out << "\t\t\"" << counterName(Counter(i)) << "\": " << counterMean(Counter(i));
+		out << (i + 1 < u32(Counter::Count) ? ",\n" : "\n");
+	}
+	out << "\t}\n";
+	out << "}\n";
+	return bool(out);
+}
+
+void Profiler::printSummary() const {
+	std::cerr << "stage      mean      p50      p99      max (ms, " << m_frames.size() << " frames)" << std::endl;
+	for (u32 i = 0; i <= u32(Stage::Count); i++) {
+		Stats st = stats(Stage(i));
+		char line[128];
+		std::snprintf(line, sizeof(line), "%-8s %8.3f %8.3f %8.3f %8.3f",
+			stageName(Stage(i)), st.mean, st.p50, st.p99, st.max
+		);
+		std::cerr << line << std::endl;
+	}
+
+	// Traversal counters, per frame and per ray
+	f64 rays = counterMean(Counter::Rays);
+	if (rays > 0.0) {
+		for (u32 i = 1; i < u32(Counter::Count); i++) {
+			f64 mean = counterMean(Counter(i));
+			char line[128];
+			std::snprintf(line, sizeof(line), "%-8s %10.1f/frame %8.2f/ray",
+				counterName(Counter(i)), mean, mean / rays
+			);
+			std::cerr << line << std::endl;
+		}
+	}
+}
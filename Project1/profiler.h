@@ -0,0 +1,78 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "integer.h"
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+
+enum class Stage : u32 {
+	Lines = 0,
+	Accel,
+	Rays,
+	Walls,
+	Flats,
+	Hud,
+	Present,
+	Count
+};
+
+enum class Counter : u32 {
+	Rays = 0,
+	Nodes,
+	Tests,
+	Fallbacks,
+	Count
+};
+
+// Per-frame, per-stage timings. Disabled by default, in which case
+// now()/add() cost a single branch and nothing is recorded.
+// add() may be called from worker threads; stages timed on several
+// threads at once accumulate CPU time, not wall time.
+class Profiler {
+public:
+	struct Frame {
+		f64 total;
+		std::array<f64, u32(Stage::Count)> stages;
+		std::array<u64, u32(Counter::Count)> counters;
+	};
+
+	struct Stats {
+		f64 mean, p50, p99, max;
+	};
+
+	void enable(bool enabled) { m_enabled = enabled; }
+	bool enabled() const { return m_enabled; }
+
+	u64 now() const;
+	void add(Stage stage, u64 since);
+	void count(Counter counter, u64 amount);
+
+	void beginFrame();
+	void endFrame();
+
+	void clear() { m_frames.clear(); }
+	const std::vector<Frame>& frames() const { return m_frames; }
+
+	// stage == Stage::Count gives the stats of the whole frame
+	Stats stats(Stage stage) const;
+	f64 counterMean(Counter counter) const;
+
+	bool writeCSV(const std::string& fileName) const;
+	bool writeJSON(const std::string& fileName, const std::string& label = "") const;
+	void printSummary() const;
+
+	static const char* stageName(Stage stage);
+	static const char* counterName(Counter counter);
+
+private:
+	bool m_enabled{ false };
+	u64 m_frameStart{ 0 };
+	std::array<std::atomic<u64>, u32(Stage::Count)> m_current{};
+	std::array<std::atomic<u64>, u32(Counter::Count)> m_counters{};
+	std::vector<Frame> m_frames;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,550 @@
+#include "raycast_game.h"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <algorithm>
+
+void RayCastGame::onSetup(GameCanvas *canvas) {
+	viewer.position = Vec3(8.0f, 8.0f, 0.0f);
+	viewer.fov = rad(90);
+
+	if (threads != 1) {
+		pool = std::unique_ptr<ThreadPool>(new ThreadPool(threads));
+	}
+
+	// Textures found in the pack are used in place, the rest is decoded
+	std::vector<TextureHandle> packed;
+	if (!packPath.empty()) {
+		if (pack.open(packPath)) packed = pack.mount(textures);
+		else std::cerr << "Could not open asset pack: " << packPath << std::endl;
+	}
+
+	// Walls are drawn down texture columns, floors and ceilings along curves in both axes.
+	// The files decode in parallel, the first frame waits for all of them.
+	tfloor = textures.loadAsync("floor.png", TextureLayout::Morton);
+	tceil = textures.loadAsync("ceiling.png", TextureLayout::Morton);
+	twall = textures.loadAsync("bricks.png", TextureLayout::ColumnMajor);
+	tpillar = textures.loadAsync("pillar.png", TextureLayout::ColumnMajor);
+	textures.wait();
+
+	// One palette for all textures, which are drawn from their indices from now on
+	if (indexedColor) {
+		palette.build(textures);
+		textures.setPalette(&palette);
+		if (canvas) canvas->setPalette(&palette);
+	}
+
+	if (pack.isOpen()) {
+		pack.models(packed, models);
+		pack.sectors(sectorPolygons);
+		return;
+	}
+
+	Block* main = new Block(0, 0, 6, 6);
+	main->texture = twall;
+	add(main);
+
+	const u32 pillars = 16;
+	const f32 step = (M_PI * 2.0f) / pillars;
+	for (f32 r = 0.0f; r < M_PI * 2.0f; r += step) {
+		Pillar* pil = new Pillar(::cosf(r) + 1.5f, ::sinf(r) + 1.5f, 0.1f);
+		pil->texture = tpillar;
+		add(pil);
+	}
+
+	// The room split in four quadrants, the inner edges become portals
+	addSector({ Vec3(0, 0, 0), Vec3(3, 0, 0), Vec3(3, 3, 0), Vec3(0, 3, 0) });
+	addSector({ Vec3(3, 0, 0), Vec3(6, 0, 0), Vec3(6, 3, 0), Vec3(3, 3, 0) });
+	addSector({ Vec3(0, 3, 0), Vec3(3, 3, 0), Vec3(3, 6, 0), Vec3(0, 6, 0) });
+	addSector({ Vec3(3, 3, 0), Vec3(6, 3, 0), Vec3(6, 6, 0), Vec3(3, 6, 0) });
+}
+
+void RayCastGame::add(Model* model) {
+	models.push_back(std::unique_ptr<Model>(model));
+}
+
+void RayCastGame::addSector(const std::vector<Vec3>& polygon) {
+	sectorPolygons.push_back(polygon);
+	sectors.clear();
+}
+
+void RayCastGame::onUpdate(GameCanvas *canvas, f32 dt) {
+	time += dt;
+
+	if (path) {
+		path->apply(viewer, time);
+		return;
+	}
+
+	if (canvas->isHeld(SDLK_x)) {
+		viewer.fov += dt;
+		if (viewer.fov >= rad(120)) {
+			viewer.fov = rad(120);
+		}
+	} else if (canvas->isHeld(SDLK_z)) {
+		viewer.fov -= dt;
+		if (viewer.fov <= rad(20)) {
+			viewer.fov = rad(20);
+		}
+	}
+
+	if (canvas->isHeld(SDLK_LEFT)) {
+		viewer.rotation -= dt * 1.8f;
+	} else if (canvas->isHeld(SDLK_RIGHT)) {
+		viewer.rotation += dt * 1.8f;
+	}
+
+	Vec3 dir(viewer.rotation);
+	if (canvas->isHeld(SDLK_UP)) {
+		Vec3 delta = dir * dt * 4.0f;
+		viewer.position = viewer.position + delta;
+		if (circleLines(viewer.position, 0.8f)) {
+			viewer.position = viewer.position - delta;
+		}
+	} else if (canvas->isHeld(SDLK_DOWN)) {
+		Vec3 delta = dir * dt * 4.0f;
+		viewer.position = viewer.position - delta;
+		if (circleLines(viewer.position, 0.8f)) {
+			viewer.position = viewer.position + delta;
+		}
+	}
+
+	if (recording) {
+		recording->add(viewer, time);
+	}
+}
+
+void RayCastGame::onDraw(GameCanvas *canvas) {
+	Profiler& prof = canvas->profiler();
+
+	// Update the lines of models that changed, textures loaded since the last frame show up here
+	u64 t0 = prof.now();
+	const u32 published = textures.publish();
+	const bool relayout = updateLines();
+	prof.add(Stage::Lines, t0);
+
+	// Refit the accelerator for the changed lines, build it from scratch if the layout changed
+	t0 = prof.now();
+	const bool changed = relayout || !changedLines.empty();
+	if (accel == Accel::BVH) {
+		if (relayout || bvh.empty()) bvh.build(lines);
+		else if (changed) bvh.refit(lines, changedLines);
+	} else if (accel == Accel::Grid) {
+		if (relayout || grid.empty()) grid.build(lines);
+		else if (changed) grid.refit(lines, changedLines);
+	} else if (accel == Accel::BSP) {
+		if (changed || bsp.empty()) bsp.build(lines);
+	} else if (accel == Accel::Portal) {
+		if (relayout || sectors.empty()) sectors.build(sectorPolygons, lines, blockSize);
+		else if (changed) sectors.refit(lines, changedLines);
+	}
+	prof.add(Stage::Accel, t0);
+
+	// Nothing moved and no line or texture changed: the framebuffer still holds this frame.
+	// Opt-in, benchmarks and headless runs draw every frame.
+	const bool still = viewer.position.x == drawnViewer.position.x && viewer.position.y == drawnViewer.position.y &&
+		viewer.rotation == drawnViewer.rotation && viewer.fov == drawnViewer.fov;
+	if (skipStill && drawn && still && !changed && published == 0) return;
+	drawnViewer = viewer;
+	drawn = true;
+
+	// The only trigonometry of the frame is the viewer rotation
+	cameraTables.update(canvas->width(), canvas->height(), viewer.fov);
+	const ColumnCamera camera(viewer, cameraTables);
+
+	// Sectors seen through portals, shared by all column ranges
+	if (accel == Accel::Portal) {
+		t0 = prof.now();
+		RayStats stats;
+		sectorsVisible = sectors.visible(camera, sectorWindows, &stats);
+		prof.count(Counter::Nodes, stats.nodes);
+		prof.add(Stage::Rays, t0);
+	}
+
+	// Render, every pass writes through the framebuffer pointers and together they cover it
+	columnHits.resize(canvas->width());
+	columnFound.resize(canvas->width());
+	wallSpans.resize(canvas->width());
+
+	// Columns and rows are independent within a pass, so workers can shade their own slices
+	if (pool) {
+		pool->parallelFor(canvas->width(), columnGrain, [&](u32 begin, u32 end, u32 worker) {
+			drawColumns(canvas, camera, begin, end);
+		});
+		pool->parallelFor(canvas->height(), rowGrain, [&](u32 begin, u32 end, u32 worker) {
+			drawRows(canvas, camera, begin, end);
+		});
+		pool->parallelFor(canvas->width(), columnGrain, [&](u32 begin, u32 end, u32 worker) {
+			drawReflections(canvas, begin, end);
+		});
+	} else {
+		drawColumns(canvas, camera, 0, canvas->width());
+		drawRows(canvas, camera, 0, canvas->height());
+		drawReflections(canvas, 0, canvas->width());
+	}
+	// The three passes rewrite every pixel, so the whole frame is the drawn region
+	canvas->markDirty(0, 0, canvas->width(), canvas->height());
+
+	t0 = prof.now();
+	if (viewer.position.x != hudPosition.x || viewer.position.y != hudPosition.y || hudText[0].empty()) {
+		hudPosition = viewer.position;
+		hudText[0] = "X: " + std::to_string(viewer.position.x);
+		hudText[1] = "Y: " + std::to_string(viewer.position.y);
+	}
+	canvas->str(hudText[0], 5, 5);
+	canvas->str(hudText[1], 5, 13);
+	prof.add(Stage::Hud, t0);
+}
+
+bool RayCastGame::updateLines() {
+	changedLines.clear();
+
+	// Models were added or changed their segment count: lay all lines out again
+	bool relayout = modelLines.size() != models.size() + 1;
+	for (u32 m = 0; m < models.size() && !relayout; m++) {
+		relayout = models[m]->lineCount() != modelLines[m + 1] - modelLines[m];
+	}
+
+	if (relayout) {
+		lines.clear();
+		modelLines.assign(1, 0);
+		for (auto&& model : models) {
+			for (u32 i = 0; i < model->lineCount(); i++) {
+				Line ln;
+				model->line(i, ln);
+				lines.push_back(ln);
+			}
+			modelLines.push_back(u32(lines.size()));
+			model->dirty = false;
+		}
+		segments.assign(lines);
+		return true;
+	}
+
+	for (u32 m = 0; m < models.size(); m++) {
+		Model& model = *models[m];
+		if (!model.dirty) continue;
+
+		for (u32 i = 0; i < model.lineCount(); i++) {
+			model.line(i, lines[modelLines[m] + i]);
+			segments.set(modelLines[m] + i, lines[modelLines[m] + i]);
+			changedLines.push_back(modelLines[m] + i);
+		}
+		model.dirty = false;
+	}
+	return false;
+}
+
+void RayCastGame::drawColumns(GameCanvas *canvas, const ColumnCamera& camera, u32 begin, u32 end) {
+	Profiler& prof = canvas->profiler();
+
+	const f32 h2 = canvas->height() / 2;
+	const f32 thf = cameraTables.tanHalfFov;
+
+	RayStats stats;
+
+	// Packets, the BSP and portal paths resolve the whole column range in one pass
+	const bool packets = accel == Accel::BVH && packetSize > 1;
+	const bool columnPass = packets || accel == Accel::BSP || (accel == Accel::Portal && sectorsVisible);
+	if (columnPass) {
+		u64 t0 = prof.now();
+		if (packets) {
+			// Adjacent columns share the BVH traversal
+			RayPacket rays;
+			const u32 size = std::min(packetSize, RayPacket::maxSize);
+			for (u32 x = begin; x < end; x += size) {
+				camera.packet(x, std::min(size, end - x), rays);
+				bvh.closestHitPacket(rays, maxDepth, &columnHits[x], &columnFound[x], &stats);
+			}
+		} else if (accel == Accel::BSP) {
+			bsp.trace(camera, begin, end, maxDepth, columnHits.data(), columnFound.data(), &stats);
+		} else {
+			sectors.trace(camera, sectorWindows, begin, end, maxDepth, columnHits.data(), columnFound.data(), &stats);
+		}
+		prof.add(Stage::Rays, t0);
+	}
+
+	for (u32 x = begin; x < end; x++) {
+		HitInfo info;
+		bool hit = false;
+
+		if (columnPass) {
+			hit = columnFound[x] == 1;
+			if (hit) hitInfo(columnHits[x], info);
+		} else {
+			u64 t0 = prof.now();
+			hit = rayLines(camera.origin, camera.ray(x), info, &stats);
+			prof.add(Stage::Rays, t0);
+		}
+
+		WallSpan& span = wallSpans[x];
+		span.wall = hit && info.distance < maxDepth;
+		span.top = span.bottom = 0;
+		if (!span.wall) continue;
+
+		const f32 d = info.distance * thf;
+		const f32 ceil = h2 - f32(canvas->height()) / d;
+		const f32 floor = canvas->height() - ceil;
+		const f32 wh = floor - ceil;
+		span.info = info;
+		span.top = ceil < 0.0f ? 0 : std::min(u32(ceil) + 1, canvas->height());
+		span.bottom = floor >= f32(canvas->height()) ? canvas->height() : u32(floor) + 1;
+
+		const u32 wallShade = fixedShade(1.0f - (d / maxDepth));
+		// One screen row covers texture height / wh texels of the wall
+		const Texture& wallTex = textures.get(info.line->texture);
+		const f32 wallLod = std::log2(f32(wallTex.height()) / wh);
+		const f32 wallU = info.line->uv(info.u);
+
+		// Written straight into the framebuffer one row pitch apart
+		const u32 pitch = canvas->pitch();
+		u32* out = indexedColor ? nullptr : canvas->pixel(x, span.top);
+
+		u64 t0 = prof.now();
+		if (indexedColor && wallShade == 0) {
+			// Fully fogged, the reserved black entry without sampling
+			u8* out8 = canvas->indexPixel(x, span.top);
+			for (u32 y = span.top; y < span.bottom; y++, out8 += pitch) *out8 = Palette::black;
+		} else if (indexedColor) {
+			// Palette indices through the colormap of the shade level
+			const u8* map = palette.level(wallShade);
+			u8* out8 = canvas->indexPixel(x, span.top);
+			for (u32 y = span.top; y < span.bottom; y++, out8 += pitch) {
+				f32 v = f32(y - ceil) / wh;
+
+				*out8 = map[wallTex.sampleIndex(wallU, v, wallLod, mipFilter)];
+			}
+		} else if (wallShade == 0) {
+			// Fully fogged (d past maxDepth), nothing to sample
+			for (u32 y = span.top; y < span.bottom; y++, out += pitch) *out = 0;
+		} else {
+			const u8* scale = shades.level(wallShade);
+			for (u32 y = span.top; y < span.bottom; y++, out += pitch) {
+				f32 v = f32(y - ceil) / wh;
+
+				*out = ShadeTable::apply(scale, wallTex.samplePacked(wallU, v, wallLod, mipFilter));
+			}
+		}
+		prof.add(Stage::Walls, t0);
+	}
+
+	prof.count(Counter::Rays, end - begin);
+	prof.count(Counter::Nodes, stats.nodes);
+	prof.count(Counter::Tests, stats.tests);
+	prof.count(Counter::Fallbacks, stats.fallbacks);
+}
+
+void RayCastGame::drawRows(GameCanvas *canvas, const ColumnCamera& camera, u32 begin, u32 end) {
+	Profiler& prof = canvas->profiler();
+	u64 t0 = prof.now();
+
+	const f32 h2 = canvas->height() / 2;
+
+	const Texture& ceilTex = textures.get(tceil);
+	const Texture& floorTex = textures.get(tfloor);
+	const f32 ceilBias = std::log2(f32(ceilTex.width()));
+	const f32 floorBias = std::log2(f32(floorTex.width()));
+
+	const u32 step = canvas->xStep();
+	const f32 dx = 2.0f / f32(canvas->width());
+
+	for (u32 y = begin; y < end; y++) {
+		// Rows above the horizon see the ceiling, rows below the floor. Every pixel
+		// of a row sees it at the same distance k along the view direction, so the
+		// point seen by column x is origin + ray(x) * k: affine in x.
+		const bool ceiling = y < h2;
+		const u32 rowShade = fixedShade(cameraTables.rowFog[y]);
+
+		const Texture& tex = ceiling ? ceilTex : floorTex;
+		const f32 lod = cameraTables.rowLod[y] + (ceiling ? ceilBias : floorBias);
+
+		// Texture coordinates of column 0 and their step per column (half a block per texture unit)
+		const f32 k = cameraTables.rowDistance[y];
+		const Vec3 left = camera.ray(0);
+		const f32 u0 = (camera.origin.x + left.x * k) / 2.0f, du = camera.plane.x * dx * k / 2.0f;
+		const f32 v0 = (camera.origin.y + left.y * k) / 2.0f, dv = camera.plane.y * dx * k / 2.0f;
+
+		if (indexedColor) {
+			u8* out8 = canvas->indexPixel(0, y);
+			if (rowShade == 0) {
+				for (u32 x = 0; x < canvas->width(); x++, out8 += step) {
+					const WallSpan& span = wallSpans[x];
+					if (y < span.top || y >= span.bottom) *out8 = Palette::black;
+				}
+				continue;
+			}
+
+			const u8* map = palette.level(rowShade);
+			for (u32 x = 0; x < canvas->width(); x++, out8 += step) {
+				const WallSpan& span = wallSpans[x];
+				if (y >= span.top && y < span.bottom) continue;
+
+				*out8 = map[tex.sampleIndex(u0 + du * x, v0 + dv * x, lod, mipFilter)];
+			}
+			continue;
+		}
+
+		u32* out = canvas->pixel(0, y);
+		if (rowShade == 0) {
+			// The horizon row is fully fogged, nothing to sample
+			for (u32 x = 0; x < canvas->width(); x++, out += step) {
+				const WallSpan& span = wallSpans[x];
+				if (y < span.top || y >= span.bottom) *out = 0;
+			}
+			continue;
+		}
+
+		const u8* scale = shades.level(rowShade);
+		for (u32 x = 0; x < canvas->width(); x++, out += step) {
+			const WallSpan& span = wallSpans[x];
+			if (y >= span.top && y < span.bottom) continue;
+
+			*out = ShadeTable::apply(scale, tex.samplePacked(u0 + du * x, v0 + dv * x, lod, mipFilter));
+		}
+	}
+
+	prof.add(Stage::Flats, t0);
+}
+
+void RayCastGame::drawReflections(GameCanvas *canvas, u32 begin, u32 end) {
+	Profiler& prof = canvas->profiler();
+	u64 t0 = prof.now();
+
+	const f32 h2 = canvas->height() / 2;
+	const f32 thf = cameraTables.tanHalfFov;
+	const u32 pitch = canvas->pitch();
+
+	for (u32 x = begin; x < end; x++) {
+		// Walls reaching the bottom edge leave no floor to reflect on
+		const WallSpan& span = wallSpans[x];
+		if (!span.wall || span.bottom >= canvas->height()) continue;
+
+		const HitInfo& info = span.info;
+		const f32 d = info.distance * thf;
+		const f32 ceil = h2 - f32(canvas->height()) / d;
+		const f32 floor = canvas->height() - ceil;
+		const f32 wh = floor - ceil;
+		const f32 fog = 1.0f - (d / maxDepth);
+
+		const Texture& wallTex = textures.get(info.line->texture);
+		const f32 wallLod = std::log2(f32(wallTex.height()) / wh);
+		const f32 wallU = info.line->uv(info.u);
+
+		// The wall mirrored below its base, fading out over one wall height
+		u32* out = indexedColor ? nullptr : canvas->pixel(x, span.bottom);
+		u8* out8 = indexedColor ? canvas->indexPixel(x, span.bottom) : nullptr;
+		for (u32 y = span.bottom, i = 0; y < canvas->height(); y++, i += pitch) {
+			f32 v = f32(y - floor) / wh;
+			if (v >= 1.0f) break;
+
+			f32 we = cameraTables.rowDistance[y] / info.distance;
+			f32 cfog = cameraTables.rowFog[y];
+
+			// The reflection fades to nothing long before the wall does, skip sampling then
+			f32 mixFac = (1.0f - v) * we;
+			const u32 f = fixedShade(fog * cfog * mixFac);
+			if (f == 0) continue;
+			if (indexedColor) {
+				out8[i] = palette.add(out8[i], palette.level(f)[wallTex.sampleIndex(wallU, 1.0f - v, wallLod, mipFilter)]);
+				continue;
+			}
+			out[i] = addSat(out[i], shades.shade(wallTex.samplePacked(wallU, 1.0f - v, wallLod, mipFilter), f));
+		}
+	}
+
+	prof.add(Stage::Flats, t0);
+}
+
+Vec3 RayCastGame::closestPoint(const Vec3& a, const Vec3& b, const Vec3& p, f32& t) {
+	Vec3 ap = p - a;
+	Vec3 ab = b - a;
+	f32 atb = ab.dot(ab);
+	f32 apab = ap.dot(ab);
+	t = apab / atb;
+	return a + ab * t;
+}
+
+bool RayCastGame::circleLines(const Vec3& o, f32 radius) {
+	for (auto&& line : lines) {
+		f32 t;
+		Vec3 p = closestPoint(line.a, line.b, o, t);
+		if (t >= 0.0f && t <= 1.0f) {
+			f32 d = (p - o).length();
+			if (d < radius) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool RayCastGame::rayLines(const Vec3& o, const Vec3& d, HitInfo& info, RayStats* stats) {
+	ClosestHit q(maxDepth);
+	query(o, d, q, stats);
+	if (q.found) {
+		hitInfo(q.hit, info);
+	}
+	return q.found;
+}
+
+template <typename Query>
+void RayCastGame::query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	switch (accel) {
+		case Accel::BVH: bvh.query(o, d, q, stats); break;
+		case Accel::Grid: grid.query(o, d, q, stats); break;
+		case Accel::BSP: bsp.query(o, d, q, stats); break;
+		case Accel::Portal: sectors.query(o, d, q, stats); break;
+		default: segments.query(o, d, q, stats); break;
+	}
+}
+
+template void RayCastGame::query(const Vec3&, const Vec3&, ClosestHit&, RayStats*) const;
+template void RayCastGame::query(const Vec3&, const Vec3&, AnyHit&, RayStats*) const;
+template void RayCastGame::query(const Vec3&, const Vec3&, SortedHits&, RayStats*) const;
+
+void RayCastGame::hitInfo(const SegmentHit& hit, HitInfo& info) {
+	const Vec3& a = lines[hit.index].a;
+	const Vec3& b = lines[hit.index].b;
+	info.distance = hit.t;
+	info.position = hit.position;
+	info.normal = hit.normal;
+	info.length = (b - a).length() / blockSize * 2.0f;
+	info.u = hit.u;
+	info.line = &lines[hit.index];
+}
+
+void RayCastGame::printStats() const {
+	if (accel == Accel::Brute) {
+		std::cerr << "Brute force: " << segments.size() << " segments, " << SegmentStore::kernel() << " kernel" << std::endl;
+	} else if (accel == Accel::BVH) {
+		const BVH::Stats& st = bvh.stats();
+		std::cerr << "BVH: " << st.segments << " segments, " << st.nodes << " nodes, "
+			<< st.leaves << " leaves, depth " << st.depth << ", build " << st.buildMs << " ms" << std::endl;
+		if (packetSize > 1) {
+			std::cerr << "Packets of " << std::min(packetSize, RayPacket::maxSize) << " rays" << std::endl;
+		}
+	} else if (accel == Accel::Grid) {
+		const Grid::Stats& st = grid.stats();
+		std::cerr << "Grid: " << st.segments << " segments, " << st.cellsX << "x" << st.cellsY << " cells of "
+			<< st.cellSize << ", " << st.references << " references, build " << st.buildMs << " ms" << std::endl;
+	} else if (accel == Accel::BSP) {
+		const BSP::Stats& st = bsp.stats();
+		std::cerr << "BSP: " << st.segments << " segments, " << st.nodes << " nodes, " << st.fragments
+			<< " fragments, " << st.splits << " splits, depth " << st.depth << ", build " << st.buildMs << " ms" << std::endl;
+	} else if (accel == Accel::Portal) {
+		const SectorMap::Stats& st = sectors.stats();
+		std::cerr << "Sectors: " << st.segments << " segments, " << st.sectors << " sectors, " << st.portals
+			<< " portals, " << st.references << " references, build " << st.buildMs << " ms" << std::endl;
+	}
+
+	static const char* filters[] = { "none", "nearest", "trilinear" };
+	std::cerr << "Mipmaps: " << filters[u32(mipFilter)] << ", " << textures.get(twall).levels() << " levels" << std::endl;
+
+	const TextureCache::Stats& ts = textures.stats();
+	std::cerr << "Textures: " << ts.textures << " cached, " << ts.requests << " requests, " << ts.duplicates << " duplicates, "
+		<< ts.missing << " missing, " << ts.pending << " pending, " << (ts.bytes + 1023) / 1024 << " KiB";
+	if (pack.isOpen()) std::cerr << " + " << (ts.viewBytes + 1023) / 1024 << " KiB mapped from a " << (pack.size() + 1023) / 1024 << " KiB pack";
+	std::cerr << std::endl;
+}
@@ -0,0 +1,122 @@
+#ifndef RAYCAST_GAME_H
+#define RAYCAST_GAME_H
+
+#include "game_canvas.h"
+#include "world.h"
+#include "camera_path.h"
+#include "thread_pool.h"
+#include "bvh.h"
+#include "grid.h"
+#include "bsp.h"
+#include "sectors.h"
+#include "segment_store.h"
+#include "asset_pack.h"
+#include "shade_table.h"
+#include "palette.h"
+
+#include <memory>
+#include <vector>
+
+enum class Accel {
+	Brute = 0,
+	BVH,
+	Grid,
+	BSP,
+	Portal
+};
+
+class RayCastGame : public GameAdapter {
+public:
+	void onSetup(GameCanvas *canvas);
+	void onUpdate(GameCanvas *canvas, f32 dt);
+	void onDraw(GameCanvas *canvas);
+
+	void add(Model* model);
+	void addSector(const std::vector<Vec3>& polygon);
+	// Frame passes: rays and walls per column, then floor and ceiling per row
+	// around the walls, then the wall reflections on the floor per column
+	void drawColumns(GameCanvas *canvas, const ColumnCamera& camera, u32 begin, u32 end);
+	void drawRows(GameCanvas *canvas, const ColumnCamera& camera, u32 begin, u32 end);
+	void drawReflections(GameCanvas *canvas, u32 begin, u32 end);
+	// Re-derives the lines of dirty models, returns true if all lines were laid out again
+	bool updateLines();
+
+	Vec3 closestPoint(const Vec3& a, const Vec3& b, const Vec3& p, f32& t);
+	bool circleLines(const Vec3& o, f32 radius);
+	bool rayLines(const Vec3& o, const Vec3& d, HitInfo& info, RayStats* stats = nullptr);
+
+	// Segment query through the selected accelerator (ClosestHit, AnyHit or SortedHits)
+	template <typename Query>
+	void query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats = nullptr) const;
+	void hitInfo(const SegmentHit& hit, HitInfo& info);
+	void printStats() const;
+
+	Viewer viewer{};
+
+	std::vector<std::unique_ptr<Model>> models;
+	// World-space lines of all models, model m owns [modelLines[m], modelLines[m + 1])
+	std::vector<Line> lines;
+	std::vector<u32> modelLines;
+	// SoA copy of the lines for the brute-force kernels
+	SegmentStore segments;
+	// Lines updated in place by the last updateLines()
+	std::vector<u32> changedLines;
+
+	// Optional pre-decoded assets (see --pack), must outlive the textures mounted from it
+	std::string packPath;
+	AssetPack pack;
+	// Indexed color (see GameCanvas::setPalette): textures are quantized to a
+	// palette built at setup and pixels are shaded through its colormaps
+	bool indexedColor{ false };
+	Palette palette;
+	TextureCache textures;
+	TextureHandle twall{ noTexture }, tfloor{ noTexture }, tceil{ noTexture }, tpillar{ noTexture };
+	MipFilter mipFilter{ MipFilter::Nearest };
+	// Fog lookup tables
+	ShadeTable shades;
+	// Column and row tables of the screen, rebuilt when its size or the fov change
+	CameraTables cameraTables;
+
+	Accel accel{ Accel::BVH };
+	// Columns traced together as a ray packet (BVH only), 0 or 1 for single rays
+	u32 packetSize{ 0 };
+	BVH bvh;
+	Grid grid;
+	// Compiled once for the static models, cleared by add()
+	BSP bsp;
+	// Sector polygons (block units) and the portal graph built from them
+	std::vector<std::vector<Vec3>> sectorPolygons;
+	SectorMap sectors;
+	std::vector<SectorMap::Window> sectorWindows;
+	bool sectorsVisible{ false };
+
+	std::vector<SegmentHit> columnHits;
+	std::vector<u8> columnFound;
+	// Wall of every screen column from the column pass, drawn over rows [top, bottom)
+	struct WallSpan {
+		bool wall;
+		u32 top, bottom;
+		HitInfo info;
+	};
+	std::vector<WallSpan> wallSpans;
+	// Pose of the last drawn frame. With skipStill, a scene that did not change
+	// is not drawn again and the window keeps the last image.
+	Viewer drawnViewer{};
+	bool drawn{ false };
+	bool skipStill{ false };
+	// HUD lines, formatted again only when the position changes
+	Vec3 hudPosition{};
+	std::string hudText[2];
+
+	// Render threads (0 = one per core, 1 = no pool) and columns/rows per work item
+	u32 threads{ 0 }, columnGrain{ 8 }, rowGrain{ 8 };
+	std::unique_ptr<ThreadPool> pool;
+
+	// When set, the viewer follows this path instead of the keyboard
+	const CameraPath* path{ nullptr };
+	// When set, every update appends the viewer pose to this path
+	CameraPath* recording{ nullptr };
+	f32 time{ 0.0f };
+};
+
+#endif // RAYCAST_GAME_H
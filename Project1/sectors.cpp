@@ -0,0 +1,274 @@
+#include "sectors.h"
+
+#include "SDL.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Points/segments closer than this are considered touching
+static const f32 TOUCH_EPSILON = 1e-3f;
+// A viewer this close to a portal sees through all of it
+static const f32 PORTAL_EPSILON = 1e-2f;
+// Guards against portal cycles in oddly shaped maps
+static const u32 MAX_FLOOD_DEPTH = 64;
+// Per-ray sector walks use a fixed list, longer walks fall back to all lines
+static const u32 MAX_RAY_SECTORS = 64;
+
+static bool inside(const std::vector<Vec3>& polygon, const Vec3& p) {
+	bool in = false;
+	for (u32 i = 0, j = u32(polygon.size()) - 1; i < polygon.size(); j = i++) {
+		const Vec3& a = polygon[i];
+		const Vec3& b = polygon[j];
+		if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x) {
+			in = !in;
+		}
+	}
+	return in;
+}
+
+// True if one of the sorted, disjoint windows holds all of [begin, end)
+static bool covered(const std::vector<SectorMap::Window>& spans, u32 begin, u32 end) {
+	for (auto&& w : spans) {
+		if (w.begin <= begin && end <= w.end) return true;
+	}
+	return false;
+}
+
+// Adds [begin, end) to the sorted, disjoint windows, merging those it overlaps or touches
+static void merge(std::vector<SectorMap::Window>& spans, u32 sector, u32 begin, u32 end) {
+	auto it = spans.begin();
+	while (it != spans.end() && it->end < begin) ++it;
+	auto last = it;
+	while (last != spans.end() && last->begin <= end) {
+		begin = std::min(begin, last->begin);
+		end = std::max(end, last->end);
+		++last;
+	}
+	it = spans.erase(it, last);
+	spans.insert(it, SectorMap::Window{ sector, begin, end });
+}
+
+static f32 pointSegDistance(const Vec3& p, const Vec3& a, const Vec3& b) {
+	Vec3 ab = b - a;
+	f32 len2 = ab.dot(ab);
+	f32 t = len2 > 0.0f ? std::min(std::max((p - a).dot(ab) / len2, 0.0f), 1.0f) : 0.0f;
+	return (a + ab * t - p).length();
+}
+
+static bool segmentsTouch(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d) {
+	auto cross = [](const Vec3& o, const Vec3& p, const Vec3& q) {
+		return (p.x - o.x) * (q.y - o.y) - (p.y - o.y) * (q.x - o.x);
+	};
+	f32 d1 = cross(c, d, a), d2 = cross(c, d, b);
+	f32 d3 = cross(a, b, c), d4 = cross(a, b, d);
+	if (((d1 > 0.0f && d2 < 0.0f) || (d1 < 0.0f && d2 > 0.0f)) &&
+		((d3 > 0.0f && d4 < 0.0f) || (d3 < 0.0f && d4 > 0.0f))) {
+		return true;
+	}
+	return pointSegDistance(a, c, d) <= TOUCH_EPSILON || pointSegDistance(b, c, d) <= TOUCH_EPSILON ||
+		pointSegDistance(c, a, b) <= TOUCH_EPSILON || pointSegDistance(d, a, b) <= TOUCH_EPSILON;
+}
+
+// Whether a segment lies (partly) inside a polygon or touches its boundary
+static bool overlaps(const std::vector<Vec3>& poly, const Vec3& a, const Vec3& b) {
+	bool result = inside(poly, a) || inside(poly, b);
+	for (u32 i = 0; i < poly.size() && !result; i++) {
+		result = segmentsTouch(a, b, poly[i], poly[(i + 1) % poly.size()]);
+	}
+	return result;
+}
+
+static bool samePoint(const Vec3& a, const Vec3& b) {
+	return std::fabs(a.x - b.x) <= TOUCH_EPSILON && std::fabs(a.y - b.y) <= TOUCH_EPSILON;
+}
+
+void SectorMap::clear() {
+	m_sectors.clear();
+	m_lineA.clear();
+	m_lineB.clear();
+	m_stats = Stats{};
+}
+
+void SectorMap::build(const std::vector<std::vector<Vec3>>& polygons, const std::vector<Line>& lines, f32 scale) {
+	u64 start = SDL_GetPerformanceCounter();
+
+	clear();
+
+	for (auto&& line : lines) {
+		m_lineA.push_back(line.a);
+		m_lineB.push_back(line.b);
+	}
+
+	for (auto&& polygon : polygons) {
+		Sector sector;
+		for (auto&& p : polygon) {
+			sector.polygon.push_back(p * scale);
+		}
+		m_sectors.push_back(sector);
+	}
+
+	// Edges shared by two sectors become portals (in both directions)
+	for (u32 s = 0; s < m_sectors.size(); s++) {
+		const std::vector<Vec3>& ps = m_sectors[s].polygon;
+		for (u32 i = 0; i < ps.size(); i++) {
+			const Vec3& a = ps[i];
+			const Vec3& b = ps[(i + 1) % ps.size()];
+
+			for (u32 o = 0; o < m_sectors.size(); o++) {
+				if (o == s) continue;
+				const std::vector<Vec3>& po = m_sectors[o].polygon;
+				for (u32 j = 0; j < po.size(); j++) {
+					const Vec3& c = po[j];
+					const Vec3& d = po[(j + 1) % po.size()];
+					if ((samePoint(a, c) && samePoint(b, d)) || (samePoint(a, d) && samePoint(b, c))) {
+						m_sectors[s].portals.push_back(Portal{ a, b, o });
+						m_stats.portals++;
+					}
+				}
+			}
+		}
+	}
+
+	// A line belongs to every sector it overlaps or touches
+	for (auto&& sector : m_sectors) {
+		const std::vector<Vec3>& poly = sector.polygon;
+		for (u32 l = 0; l < m_lineA.size(); l++) {
+			if (overlaps(poly, m_lineA[l], m_lineB[l])) {
+				sector.lines.push_back(l);
+				m_stats.references++;
+			}
+		}
+	}
+
+	m_stats.sectors = u32(m_sectors.size());
+	m_stats.segments = u32(lines.size());
+	m_stats.buildMs = f64(SDL_GetPerformanceCounter() - start) * 1000.0 / f64(SDL_GetPerformanceFrequency());
+}
+
+void SectorMap::refit(const std::vector<Line>& lines, const std::vector<u32>& changed) {
+	for (u32 l : changed) {
+		m_lineA[l] = lines[l].a;
+		m_lineB[l] = lines[l].b;
+
+		for (auto&& sector : m_sectors) {
+			auto it = std::lower_bound(sector.lines.begin(), sector.lines.end(), l);
+			const bool listed = it != sector.lines.end() && *it == l;
+			const bool overlapping = overlaps(sector.polygon, m_lineA[l], m_lineB[l]);
+			if (listed && !overlapping) {
+				sector.lines.erase(it);
+				m_stats.references--;
+			} else if (!listed && overlapping) {
+				sector.lines.insert(it, l);
+				m_stats.references++;
+			}
+		}
+	}
+}
+
+i32 SectorMap::locate(const Vec3& p) const {
+	for (u32 i = 0; i < m_sectors.size(); i++) {
+		if (inside(m_sectors[i].polygon, p)) return i32(i);
+	}
+	return -1;
+}
+
+bool SectorMap::visible(const ColumnCamera& camera, std::vector<Window>& windows, RayStats* stats) const {
+	windows.clear();
+
+	i32 start = locate(camera.origin);
+	if (start < 0) return false;
+
+	std::vector<std::vector<Window>> seen(m_sectors.size());
+	flood(camera, u32(start), 0, camera.width, 0, seen, windows, stats);
+	return true;
+}
+
+void SectorMap::flood(const ColumnCamera& camera, u32 sector, u32 begin, u32 end, u32 depth,
+	std::vector<std::vector<Window>>& seen, std::vector<Window>& windows, RayStats* stats) const
+{
+	if (depth > MAX_FLOOD_DEPTH) return;
+	// Every column of the window was already seen through earlier ones
+	if (covered(seen[sector], begin, end)) return;
+
+	merge(seen[sector], sector, begin, end);
+	windows.push_back(Window{ sector, begin, end });
+	if (stats) stats->nodes++;
+
+	for (auto&& portal : m_sectors[sector].portals) {
+		u32 x0 = begin, x1 = end;
+		if (pointSegDistance(camera.origin, portal.a, portal.b) <= PORTAL_EPSILON ||
+			camera.columns(portal.a, portal.b, begin, end, x0, x1)) {
+			flood(camera, portal.sector, x0, x1, depth + 1, seen, windows, stats);
+		}
+	}
+}
+
+void SectorMap::trace(
+	const ColumnCamera& camera, const std::vector<Window>& windows, u32 begin, u32 end, f32 tmax,
+	SegmentHit* hits, u8* found, RayStats* stats) const
+{
+	for (u32 x = begin; x < end; x++) {
+		const Vec3 d = camera.ray(x);
+		ClosestHit q(tmax);
+
+		for (auto&& w : windows) {
+			if (x < w.begin || x >= w.end) continue;
+			if (stats) stats->nodes++;
+			for (u32 l : m_sectors[w.sector].lines) {
+				querySegment(q, l, camera.origin, d, m_lineA[l], m_lineB[l], stats);
+			}
+		}
+		if (q.found) hits[x] = q.hit;
+		found[x] = q.found ? 1 : 0;
+	}
+}
+
+bool SectorMap::closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats) const {
+	ClosestHit q(tmax);
+	query(o, d, q, stats);
+	if (q.found) hit = q.hit;
+	return q.found;
+}
+
+template <typename Query>
+void SectorMap::query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	// Outside every sector (or too many sectors for the fixed list): test everything
+	auto queryAll = [&]() {
+		for (u32 l = 0; l < m_lineA.size() && !q.done(); l++) {
+			querySegment(q, l, o, d, m_lineA[l], m_lineB[l], stats);
+		}
+	};
+
+	i32 start = locate(o);
+	if (start < 0) return queryAll();
+
+	u32 visited[MAX_RAY_SECTORS];
+	u32 count = 0;
+	visited[count++] = u32(start);
+
+	for (u32 i = 0; i < count; i++) {
+		const Sector& sector = m_sectors[visited[i]];
+		if (stats) stats->nodes++;
+		for (u32 l : sector.lines) {
+			querySegment(q, l, o, d, m_lineA[l], m_lineB[l], stats);
+		}
+		if (q.done()) return;
+
+		// Continue into sectors behind portals the ray crosses within the query limit
+		for (auto&& portal : sector.portals) {
+			Vec3 hitPos, hitNorm;
+			f32 t, u;
+			const bool onPortal = pointSegDistance(o, portal.a, portal.b) <= PORTAL_EPSILON;
+			if (!onPortal && (!raySeg(o, d, portal.a, portal.b, hitPos, hitNorm, t, u) || t > q.limit())) continue;
+			if (std::find(visited, visited + count, portal.sector) != visited + count) continue;
+
+			if (count == MAX_RAY_SECTORS) return queryAll();
+			visited[count++] = portal.sector;
+		}
+	}
+}
+
+template void SectorMap::query(const Vec3&, const Vec3&, ClosestHit&, RayStats*) const;
+template void SectorMap::query(const Vec3&, const Vec3&, AnyHit&, RayStats*) const;
+template void SectorMap::query(const Vec3&, const Vec3&, SortedHits&, RayStats*) const;
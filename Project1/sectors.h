@@ -0,0 +1,76 @@
+#ifndef SECTORS_H
+#define SECTORS_H
+
+#include "world.h"
+#include "segment_query.h"
+
+#include <vector>
+
+// Sector/portal view of the world. Sectors are (convex-ish) polygons given
+// in block units; an edge shared by two sector polygons is a portal, every
+// other edge must be backed by solid geometry. Each sector references the
+// lines that overlap it, so rays only test lines of sectors they can reach
+// through portals inside the view frustum.
+class SectorMap {
+public:
+	struct Portal {
+		Vec3 a, b;
+		u32 sector; // sector on the other side
+	};
+
+	struct Sector {
+		std::vector<Vec3> polygon;
+		std::vector<u32> lines;
+		std::vector<Portal> portals;
+	};
+
+	// Column window [begin, end) through which a sector is seen this frame
+	struct Window {
+		u32 sector, begin, end;
+	};
+
+	struct Stats {
+		u32 sectors, portals, references, segments;
+		f64 buildMs;
+	};
+
+	// polygons are scaled by scale, lines are already in world space
+	void build(const std::vector<std::vector<Vec3>>& polygons, const std::vector<Line>& lines, f32 scale);
+	// Moves the changed lines (same count as the build) to the sectors they now overlap
+	void refit(const std::vector<Line>& lines, const std::vector<u32>& changed);
+	void clear();
+
+	// Sector containing a world-space point, -1 if outside every sector
+	i32 locate(const Vec3& p) const;
+
+	// Floods from the viewer's sector through the portals, narrowing the column
+	// window at every portal. Returns false if the viewer is outside all sectors.
+	bool visible(const ColumnCamera& camera, std::vector<Window>& windows, RayStats* stats = nullptr) const;
+
+	// Closest hit per column in [begin, end) using the windows from visible()
+	void trace(
+		const ColumnCamera& camera, const std::vector<Window>& windows, u32 begin, u32 end, f32 tmax,
+		SegmentHit* hits, u8* found, RayStats* stats = nullptr
+	) const;
+
+	// Closest hit along one ray, visiting only sectors behind portals it crosses.
+	// Tests every line if the origin is outside all sectors.
+	bool closestHit(const Vec3& o, const Vec3& d, f32 tmax, SegmentHit& hit, RayStats* stats = nullptr) const;
+
+	// Feeds the hits along a ray to a ClosestHit, AnyHit or SortedHits query
+	template <typename Query>
+	void query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats = nullptr) const;
+
+	const Stats& stats() const { return m_stats; }
+	bool empty() const { return m_sectors.empty(); }
+
+private:
+	void flood(const ColumnCamera& camera, u32 sector, u32 begin, u32 end, u32 depth,
+		std::vector<std::vector<Window>>& seen, std::vector<Window>& windows, RayStats* stats) const;
+
+	std::vector<Sector> m_sectors;
+	std::vector<Vec3> m_lineA, m_lineB; // source segments
+	Stats m_stats{};
+};
+
+#endif // SECTORS_H
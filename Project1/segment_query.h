@@ -0,0 +1,90 @@
+#ifndef SEGMENT_QUERY_H
+#define SEGMENT_QUERY_H
+
+#include "world.h"
+
+// Hit collectors for segment queries. They never allocate: the accelerators
+// feed them candidate hits through add() and use limit() to cull anything
+// that can't be accepted anymore, and done() to stop early.
+// Hits at equal t are ordered by line index, like a stable sort would.
+
+// Closest hit with t < tmax
+struct ClosestHit {
+	SegmentHit hit;
+	bool found{ false };
+	f32 tmax;
+
+	explicit ClosestHit(f32 tmax = maxDepth) : tmax(tmax) {}
+
+	f32 limit() const { return found ? hit.t : tmax; }
+	bool done() const { return false; }
+
+	void add(u32 index, const Vec3& position, const Vec3& normal, f32 t, f32 u) {
+		if (t < limit() || (found && t == hit.t && index < hit.index)) {
+			found = true;
+			hit = SegmentHit{ index, position, normal, t, u };
+		}
+	}
+};
+
+// Any hit with t < tmax, for occlusion tests
+struct AnyHit {
+	SegmentHit hit;
+	bool found{ false };
+	f32 tmax;
+
+	explicit AnyHit(f32 tmax) : tmax(tmax) {}
+
+	f32 limit() const { return tmax; }
+	bool done() const { return found; }
+
+	void add(u32 index, const Vec3& position, const Vec3& normal, f32 t, f32 u) {
+		if (!found && t < tmax) {
+			found = true;
+			hit = SegmentHit{ index, position, normal, t, u };
+		}
+	}
+};
+
+// The k closest hits with t < tmax, sorted front to back into a caller-provided buffer
+struct SortedHits {
+	SegmentHit* hits;
+	u32 capacity, count{ 0 };
+	f32 tmax;
+
+	SortedHits(SegmentHit* hits, u32 capacity, f32 tmax) : hits(hits), capacity(capacity), tmax(tmax) {}
+
+	f32 limit() const { return count == capacity && count > 0 ? hits[count - 1].t : tmax; }
+	bool done() const { return capacity == 0; }
+
+	void add(u32 index, const Vec3& position, const Vec3& normal, f32 t, f32 u) {
+		if (t >= tmax || capacity == 0) return;
+
+		// Accelerators may report the same line more than once (shared cells, split fragments)
+		u32 pos = count;
+		for (u32 i = 0; i < count; i++) {
+			if (hits[i].index == index) return;
+			if (pos == count && (t < hits[i].t || (t == hits[i].t && index < hits[i].index))) pos = i;
+		}
+		if (pos == capacity) return;
+
+		u32 last = count < capacity ? count++ : count - 1;
+		for (u32 i = last; i > pos; i--) {
+			hits[i] = hits[i - 1];
+		}
+		hits[pos] = SegmentHit{ index, position, normal, t, u };
+	}
+};
+
+// Intersects one segment and hands the hit to the query
+template <typename Query>
+inline void querySegment(Query& query, u32 index, const Vec3& o, const Vec3& d, const Vec3& a, const Vec3& b, RayStats* stats) {
+	Vec3 hitPos, hitNorm;
+	f32 t, u;
+	if (stats) stats->tests++;
+	if (raySeg(o, d, a, b, hitPos, hitNorm, t, u)) {
+		query.add(index, hitPos, hitNorm, t, u);
+	}
+}
+
+#endif // SEGMENT_QUERY_H
@@ -0,0 +1,126 @@
+#include "segment_store.h"
+#include "simd.h"
+
+#include <algorithm>
+
+// Arrays are padded so the widest kernel never reads past the end
+static const u32 PADDING = 8;
+
+void SegmentStore::assign(const std::vector<Line>& lines) {
+	m_size = u32(lines.size());
+	const u32 padded = (m_size + PADDING - 1) / PADDING * PADDING;
+	for (auto* v : { &m_ax, &m_ay, &m_dx, &m_dy, &m_u0, &m_u1 }) {
+		v->assign(padded, 0.0f);
+	}
+	m_tex.assign(padded, noTexture);
+
+	for (u32 i = 0; i < m_size; i++) {
+		set(i, lines[i]);
+	}
+}
+
+void SegmentStore::set(u32 i, const Line& line) {
+	m_ax[i] = line.a.x;
+	m_ay[i] = line.a.y;
+	m_dx[i] = line.b.x - line.a.x;
+	m_dy[i] = line.b.y - line.a.y;
+	m_u0[i] = line.u0;
+	m_u1[i] = line.u1;
+	m_tex[i] = line.texture;
+}
+
+const char* SegmentStore::kernel() {
+#if defined(SIMD_AVX)
+	return "avx";
+#elif defined(SIMD_SSE)
+	return "sse";
+#else
+	return "scalar";
+#endif
+}
+
+template <typename Query>
+void SegmentStore::query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats) const {
+	// Same expressions as raySeg (v1 = o - a, v2 = b - a, v3 = (-d.y, d.x)),
+	// including the + 0 of the z terms, which turns a -0 denominator into +0
+	auto hit = [&](u32 i, f32 t, f32 u) {
+		// Position and normal are built the same way raySeg does
+		q.add(i, Vec3(m_ax[i] + m_dx[i] * u, m_ay[i] + m_dy[i] * u, 0.0f), Vec3(-m_dy[i], m_dx[i]), t, u);
+	};
+
+#if defined(SIMD_AVX)
+	const __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y);
+	const __m256 v3x = _mm256_set1_ps(-d.y), v3y = _mm256_set1_ps(d.x);
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+	alignas(32) f32 ts[8], us[8];
+
+	for (u32 i = 0; i < m_size && !q.done(); i += 8) {
+		if (stats) stats->tests += std::min(m_size - i, 8u);
+		const __m256 dx = _mm256_loadu_ps(&m_dx[i]), dy = _mm256_loadu_ps(&m_dy[i]);
+		const __m256 v1x = _mm256_sub_ps(ox, _mm256_loadu_ps(&m_ax[i]));
+		const __m256 v1y = _mm256_sub_ps(oy, _mm256_loadu_ps(&m_ay[i]));
+
+		const __m256 d23 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, v3x), _mm256_mul_ps(dy, v3y)), zero);
+		const __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(dx, v1y), _mm256_mul_ps(dy, v1x)), d23);
+		const __m256 u = _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v1x, v3x), _mm256_mul_ps(v1y, v3y)), zero), d23);
+
+		__m256 in = _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+		in = _mm256_and_ps(in, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+		in = _mm256_and_ps(in, _mm256_cmp_ps(t, _mm256_set1_ps(q.limit()), _CMP_LE_OQ));
+
+		u32 mask = u32(_mm256_movemask_ps(in));
+		if (m_size - i < 8) mask &= (1u << (m_size - i)) - 1u;
+		if (mask == 0) continue;
+
+		_mm256_store_ps(ts, t);
+		_mm256_store_ps(us, u);
+		for (u32 lane = 0; lane < 8; lane++) {
+			if (mask & (1u << lane)) hit(i + lane, ts[lane], us[lane]);
+		}
+	}
+#elif defined(SIMD_SSE)
+	const __m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y);
+	const __m128 v3x = _mm_set1_ps(-d.y), v3y = _mm_set1_ps(d.x);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	alignas(16) f32 ts[4], us[4];
+
+	for (u32 i = 0; i < m_size && !q.done(); i += 4) {
+		if (stats) stats->tests += std::min(m_size - i, 4u);
+		const __m128 dx = _mm_loadu_ps(&m_dx[i]), dy = _mm_loadu_ps(&m_dy[i]);
+		const __m128 v1x = _mm_sub_ps(ox, _mm_loadu_ps(&m_ax[i]));
+		const __m128 v1y = _mm_sub_ps(oy, _mm_loadu_ps(&m_ay[i]));
+
+		const __m128 d23 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, v3x), _mm_mul_ps(dy, v3y)), zero);
+		const __m128 t = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(dx, v1y), _mm_mul_ps(dy, v1x)), d23);
+		const __m128 u = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(v1x, v3x), _mm_mul_ps(v1y, v3y)), zero), d23);
+
+		__m128 in = _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmpge_ps(u, zero));
+		in = _mm_and_ps(in, _mm_cmple_ps(u, one));
+		in = _mm_and_ps(in, _mm_cmple_ps(t, _mm_set1_ps(q.limit())));
+
+		u32 mask = u32(_mm_movemask_ps(in));
+		if (m_size - i < 4) mask &= (1u << (m_size - i)) - 1u;
+		if (mask == 0) continue;
+
+		_mm_store_ps(ts, t);
+		_mm_store_ps(us, u);
+		for (u32 lane = 0; lane < 4; lane++) {
+			if (mask & (1u << lane)) hit(i + lane, ts[lane], us[lane]);
+		}
+	}
+#else
+	const f32 v3x = -d.y, v3y = d.x;
+	for (u32 i = 0; i < m_size && !q.done(); i++) {
+		if (stats) stats->tests++;
+		const f32 v1x = o.x - m_ax[i], v1y = o.y - m_ay[i];
+		const f32 d23 = (m_dx[i] * v3x + m_dy[i] * v3y) + 0.0f;
+		const f32 t = (m_dx[i] * v1y - m_dy[i] * v1x) / d23;
+		const f32 u = (v1x * v3x + v1y * v3y + 0.0f) / d23;
+		if (t >= 0.0f && u >= 0.0f && u <= 1.0f) hit(i, t, u);
+	}
+#endif
+}
+
+template void SegmentStore::query(const Vec3&, const Vec3&, ClosestHit&, RayStats*) const;
+template void SegmentStore::query(const Vec3&, const Vec3&, AnyHit&, RayStats*) const;
+template void SegmentStore::query(const Vec3&, const Vec3&, SortedHits&, RayStats*) const;
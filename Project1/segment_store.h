@@ -0,0 +1,40 @@
+#ifndef SEGMENT_STORE_H
+#define SEGMENT_STORE_H
+
+#include "world.h"
+#include "segment_query.h"
+
+#include <vector>
+
+// Structure-of-arrays copy of the world lines: start point, direction
+// (b - a), texture coordinates and texture handle, without the unused z.
+// Rays are intersected against a batch of segments per iteration with
+// AVX (8 lanes) or SSE (4 lanes) when the compiler targets them, or a
+// scalar loop otherwise (define SIMD_SCALAR to force it).
+// Every lane does the same float operations as raySeg, so hits are
+// bit-for-bit identical as long as the compiler doesn't fuse multiply-adds
+// (MSVC /fp:precise doesn't, GCC needs -ffp-contract=off when FMA is enabled).
+class SegmentStore {
+public:
+	void assign(const std::vector<Line>& lines);
+	// Updates one line, the store must have been assigned the same line count
+	void set(u32 i, const Line& line);
+
+	// Feeds the hits with segments [0, size()) to a ClosestHit, AnyHit or SortedHits query
+	template <typename Query>
+	void query(const Vec3& o, const Vec3& d, Query& q, RayStats* stats = nullptr) const;
+
+	u32 size() const { return m_size; }
+	TextureHandle texture(u32 i) const { return m_tex[i]; }
+
+	// Name of the kernel compiled in ("avx", "sse" or "scalar")
+	static const char* kernel();
+
+private:
+	u32 m_size{ 0 };
+	// Padded to a multiple of the batch size
+	std::vector<f32> m_ax, m_ay, m_dx, m_dy, m_u0, m_u1;
+	std::vector<TextureHandle> m_tex;
+};
+
+#endif // SEGMENT_STORE_H
@@ -0,0 +1,122 @@
+#include "self_test.h"
+#include "segment_store.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+// The compiled SegmentStore kernel against raySeg: every hit of every ray,
+// with t and u compared bit for bit
+static bool segmentKernel(std::mt19937& rng) {
+	const u32 lineCount = 61, rayCount = 20000; // not a multiple of the batch size
+	std::uniform_real_distribution<f32> coord(-8.0f, 8.0f);
+	std::uniform_int_distribution<u32> pick(0, 3);
+
+	// Random segments, plus axis-aligned ones and integer coordinates, where
+	// signed zeros and exact ties show up
+	std::vector<Line> lines(lineCount);
+	for (u32 i = 0; i < lineCount; i++) {
+		Line& ln = lines[i];
+		ln.a = Vec3(coord(rng), coord(rng), 0.0f);
+		ln.b = Vec3(coord(rng), coord(rng), 0.0f);
+		if (i % 3 == 1) ln.b.x = ln.a.x;
+		if (i % 3 == 2) {
+			ln.a = Vec3(std::floor(ln.a.x), std::floor(ln.a.y), 0.0f);
+			ln.b = Vec3(std::floor(ln.b.x), ln.a.y, 0.0f);
+		}
+		ln.u0 = 0.0f;
+		ln.u1 = 1.0f;
+	}
+	SegmentStore store;
+	store.assign(lines);
+
+	std::vector<SegmentHit> hits(lineCount);
+	u32 failures = 0;
+	for (u32 r = 0; r < rayCount; r++) {
+		const Vec3 o(coord(rng), coord(rng), 0.0f);
+		Vec3 d;
+		switch (pick(rng)) {
+			case 0: d = Vec3(1.0f, 0.0f, 0.0f); break;
+			case 1: d = Vec3(0.0f, -1.0f, 0.0f); break;
+			default: {
+				const f32 a = coord(rng);
+				d = Vec3(std::cos(a), std::sin(a), 0.0f);
+			} break;
+		}
+
+		SortedHits q(hits.data(), lineCount, std::numeric_limits<f32>::infinity());
+		store.query(o, d, q);
+
+		u32 expected = 0;
+		bool same = true;
+		for (u32 i = 0; i < lineCount; i++) {
+			Vec3 hitPos, hitNorm;
+			f32 t, u;
+			if (!raySeg(o, d, lines[i].a, lines[i].b, hitPos, hitNorm, t, u)) continue;
+			expected++;
+
+			const SegmentHit* found = nullptr;
+			for (u32 h = 0; h < q.count; h++) {
+				if (hits[h].index == i) found = &hits[h];
+			}
+			if (!found || std::memcmp(&found->t, &t, sizeof(f32)) != 0 || std::memcmp(&found->u, &u, sizeof(f32)) != 0) same = false;
+		}
+		if (!same || expected != q.count) failures++;
+	}
+
+	std::cerr << "segment kernel (" << SegmentStore::kernel() << ") vs raySeg: " << rayCount << " rays, "
+		<< failures << " mismatches" << std::endl;
+	return failures == 0;
+}
+
+// Texture::samplePacked (8.8 fixed-point weights) against the float
+// Texture::sample, per channel within a rounding tolerance, in every layout
+static bool packedSampling(std::mt19937& rng) {
+	const u32 size = 64, sampleCount = 20000, tolerance = 2;
+	std::uniform_real_distribution<f32> coord(0.0f, 4.0f);
+
+	// Random texels for all levels, stored as is: both samplers read through the layout
+	u32 count = 0;
+	for (u32 w = size, h = size;; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u)) {
+		count += w * h;
+		if (w == 1 && h == 1) break;
+	}
+	std::vector<u32> texels(count);
+	for (u32& t : texels) t = rng() & 0xFFFFFF;
+
+	u32 failures = 0, worst = 0;
+	for (TextureLayout layout : { TextureLayout::RowMajor, TextureLayout::ColumnMajor, TextureLayout::Morton }) {
+		Texture tex = Texture::view(size, size, layout, texels.data(), count);
+		for (u32 i = 0; i < sampleCount; i++) {
+			const f32 u = coord(rng), v = coord(rng);
+			const u32 packed = tex.samplePacked(u, v);
+			const Vec3 ref = tex.sample(u, v) * 255.0f;
+			const f32 channels[] = { ref.x, ref.y, ref.z };
+			const u32 values[] = { red(packed), green(packed), blue(packed) };
+			bool close = true;
+			for (u32 c = 0; c < 3; c++) {
+				const u32 diff = u32(std::fabs(f32(values[c]) - channels[c]) + 0.5f);
+				worst = std::max(worst, diff);
+				close = close && diff <= tolerance;
+			}
+			if (!close) failures++;
+		}
+	}
+
+	std::cerr << "samplePacked vs sample: " << sampleCount * 3 << " samples, max channel error " << worst
+		<< " (tolerance " << tolerance << "), " << failures << " mismatches" << std::endl;
+	return failures == 0;
+}
+
+bool selfTest(u32 seed) {
+	std::mt19937 rng(seed);
+	bool ok = true;
+	ok = segmentKernel(rng) && ok;
+	ok = packedSampling(rng) && ok;
+	return ok;
+}
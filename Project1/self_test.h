@@ -0,0 +1,10 @@
+#ifndef SELF_TEST_H
+#define SELF_TEST_H
+
+#include "integer.h"
+
+// Checks of the optimized paths against the code they stand in for, run by
+// --selftest. Prints one line per check to std::cerr, returns true if all passed.
+bool selfTest(u32 seed = 1);
+
+#endif // SELF_TEST_H
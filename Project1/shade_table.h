@@ -0,0 +1,35 @@
+#ifndef SHADE_TABLE_H
+#define SHADE_TABLE_H
+
+#include "pixel.h"
+
+// Light/fog table in the style of Doom's colormaps, for truecolor pixels:
+// for every 8.8 shade factor (see fixedShade) a 256 entry table of the
+// scaled channel values. Shading is then three lookups in one table, with
+// the same result as shade(). Spans with a single factor fetch their table
+// once, so only 256 bytes of it are hot at a time.
+class ShadeTable {
+public:
+	static const u32 levels = 257;
+
+	ShadeTable() {
+		for (u32 f = 0; f < levels; f++) {
+			for (u32 c = 0; c < 256; c++) {
+				m_scale[f][c] = u8(c * f >> 8);
+			}
+		}
+	}
+
+	const u8* level(u32 f) const { return m_scale[f]; }
+
+	static u32 apply(const u8* scale, u32 c) {
+		return scale[red(c)] | (u32(scale[green(c)]) << 8) | (u32(scale[blue(c)]) << 16);
+	}
+
+	u32 shade(u32 c, u32 f) const { return apply(m_scale[f], c); }
+
+private:
+	u8 m_scale[levels][256];
+};
+
+#endif // SHADE_TABLE_H
@@ -0,0 +1,21 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Instruction sets the SIMD kernels may use, picked from the compiler
+// target (/arch, -m flags). Define SIMD_SCALAR to build the scalar
+// fallbacks only.
+#if !defined(SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#if !defined(SIMD_SCALAR) && defined(__AVX__)
+#define SIMD_AVX
+#include <immintrin.h>
+#endif
+
+#if !defined(SIMD_SCALAR) && defined(__AVX2__)
+#define SIMD_AVX2
+#endif
+
+#endif // SIMD_H
@@ -1,5 +1,7 @@
 #ifndef STB_IMAGE_IMPLEMENTATION
 #	define STB_IMAGE_IMPLEMENTATION
+// Textures decode on loader threads, failure strings are written to unsynchronized globals
+#	define STBI_NO_FAILURE_STRINGS
 #	include "stb_image.h"
 #endif
 
@@ -0,0 +1,333 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "vec3.h"
+#include "pixel.h"
+#include "simd.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// How samplePacked() picks mip levels for a level of detail
+enum class MipFilter {
+	None, // always the full-size texture
+	Nearest, // bilinear in the closest level
+	Trilinear // bilinear in the two closest levels, blended
+};
+
+// Texel order in memory, picked for how a texture is walked
+enum class TextureLayout {
+	RowMajor,
+	ColumnMajor, // walls: a screen column walks one texture column
+	Morton // floors/ceilings: Z-order, square power-of-two textures only
+};
+
+// Spreads the low 16 bits of v to the even bits
+inline u32 spreadBits(u32 v) {
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+class Texture {
+public:
+	Texture() = default;
+	~Texture() = default;
+
+	Texture(const std::string& fileName, TextureLayout layout = TextureLayout::RowMajor) {
+		i32 w, h, comp;
+		u8* pixels = stbi_load(fileName.c_str(), &w, &h, &comp, 3);
+		if (pixels) {
+			m_width = w;
+			m_height = h;
+			m_texels.resize(w * h);
+			for (u32 i = 0; i < m_texels.size(); i++) {
+				m_texels[i] = packRGB(pixels[i * 3 + 0], pixels[i * 3 + 1], pixels[i * 3 + 2]);
+			}
+			stbi_image_free(pixels);
+			buildMips();
+
+			// Z-order needs square power-of-two levels, keep rows otherwise
+			const bool pow2 = w == h && (w & (w - 1)) == 0 && w <= 0x10000;
+			if (layout != TextureLayout::Morton || pow2) setLayout(layout);
+		}
+	}
+
+	inline Vec3 sample(f32 u, f32 v) {
+		u = u * m_width;
+		v = v * m_height;
+
+		u32 x = ::floor(u);
+		u32 y = ::floor(v);
+
+		f32 ur = u - x;
+		f32 vr = v - y;
+		f32 uo = 1.0f - ur;
+		f32 vo = 1.0f - vr;
+
+		Vec3 res =
+			(get(x, y) * uo + get(x + 1, y) * ur) * vo +
+			(get(x, y + 1) * uo + get(x + 1, y + 1) * ur) * vr;
+		return res;
+	}
+
+	// Non-owning texture over texels that are already in layout and hold every
+	// mip level (e.g. mapped from an asset pack), they must outlive it.
+	// Returns an empty texture if count or layout don't fit the size.
+	static Texture view(u32 width, u32 height, TextureLayout layout, const u32* texels, u32 count) {
+		Texture tex;
+		tex.m_width = width;
+		tex.m_height = height;
+		const bool pow2 = width == height && (width & (width - 1)) == 0 && width <= 0x10000;
+		if (width == 0 || height == 0 || tex.buildLevels() != count) return Texture();
+		if (layout == TextureLayout::Morton && !pow2) return Texture();
+
+		tex.m_view = texels;
+		tex.m_viewCount = count;
+		tex.m_layout = layout;
+		if (layout == TextureLayout::Morton) tex.buildSpread();
+		return tex;
+	}
+
+	inline Vec3 get(u32 x, u32 y) {
+		if (m_width == 0 || m_height == 0) return Vec3(1.0f, 0.0f, 1.0f);
+
+		x = x % m_width;
+		y = y % m_height;
+		u32 texel = data()[texelIndex(m_levels[0], x, y)];
+		f32 r = f32(red(texel)) / 255.0f;
+		f32 g = f32(green(texel)) / 255.0f;
+		f32 b = f32(blue(texel)) / 255.0f;
+		return Vec3(r, g, b);
+	}
+
+	// Bilinear sample as a packed pixel, blended with 8.8 fixed-point weights.
+	// Same footprint as sample(), which stays as the float reference (see --selftest).
+	inline u32 samplePacked(f32 u, f32 v) const {
+		if (m_width == 0 || m_height == 0) return packRGB(255, 0, 255);
+		return sampleLevel(m_levels[0], u, v);
+	}
+
+	// Same, from the mip levels matching lod (log2 of the texels covered by one pixel)
+	inline u32 samplePacked(f32 u, f32 v, f32 lod, MipFilter filter) const {
+		if (filter == MipFilter::None || lod <= 0.0f || m_levels.size() < 2) return samplePacked(u, v);
+
+		const u32 last = u32(m_levels.size() - 1);
+		if (lod >= f32(last)) return sampleLevel(m_levels[last], u, v);
+		if (filter == MipFilter::Nearest) return sampleLevel(m_levels[u32(lod + 0.5f)], u, v);
+
+		const u32 level = u32(lod);
+		const u32 f = u32((lod - f32(level)) * 256.0f);
+		const u32 fine = sampleLevel(m_levels[level], u, v);
+		return f == 0 ? fine : lerpRGB(fine, sampleLevel(m_levels[level + 1], u, v), f);
+	}
+
+	// Palette index of the nearest texel in the mip level matching lod, for the
+	// indexed render mode. The missing entry until setIndices() was called.
+	inline u8 sampleIndex(f32 u, f32 v, f32 lod, MipFilter filter) const {
+		if (m_indices.empty()) return 1;
+
+		const u32 last = u32(m_levels.size() - 1);
+		const Level& level = m_levels[filter == MipFilter::None || lod <= 0.0f ? 0 : std::min(u32(lod + 0.5f), last)];
+		i32 x = i32(std::floor(u * level.width)) % i32(level.width), y = i32(std::floor(v * level.height)) % i32(level.height);
+		if (x < 0) x += level.width;
+		if (y < 0) y += level.height;
+
+		if (m_layout == TextureLayout::Morton) return m_indices[level.offset + (m_spread[x] | (m_spread[y] << 1))];
+		return m_indices[texelIndex(level, u32(x), u32(y))];
+	}
+
+	// Palette indices of all texels in layout order (see Palette::quantize)
+	void setIndices(std::vector<u8>&& indices) { m_indices = std::move(indices); }
+	bool indexed() const { return !m_indices.empty(); }
+	const u8* indices() const { return m_indices.data(); }
+
+	u32 width() const { return m_width; }
+	u32 height() const { return m_height; }
+	u32 levels() const { return u32(m_levels.size()); }
+	TextureLayout layout() const { return m_layout; }
+	bool empty() const { return texelCount() == 0; }
+
+	// Texels of all levels in layout order
+	const u32* data() const { return m_view ? m_view : m_texels.data(); }
+	u32 texelCount() const { return m_view ? m_viewCount : u32(m_texels.size()); }
+
+	// Heap memory held by the texels of all levels and the lookup tables
+	u64 bytes() const {
+		return (m_texels.size() + m_spread.size()) * sizeof(u32) + m_indices.size() + m_levels.size() * sizeof(Level);
+	}
+	// Texels used in place from memory owned elsewhere
+	u64 viewBytes() const { return m_view ? u64(m_viewCount) * sizeof(u32) : 0; }
+
+	// FNV-1a of the layout, size and texels, for deduplication
+	u64 contentHash() const {
+		u64 hash = 0xCBF29CE484222325ull;
+		auto mix = [&](u32 v) { hash = (hash ^ v) * 0x100000001B3ull; };
+		mix(u32(m_layout));
+		mix(m_width);
+		mix(m_height);
+		const u32* texels = data();
+		for (u32 i = 0; i < texelCount(); i++) mix(texels[i]);
+		return hash;
+	}
+
+	bool sameTexels(const Texture& o) const {
+		return m_layout == o.m_layout && m_width == o.m_width && m_height == o.m_height &&
+			texelCount() == o.texelCount() && std::equal(data(), data() + texelCount(), o.data());
+	}
+
+private:
+	struct Level {
+		u32 width, height, offset;
+	};
+
+	template <TextureLayout L>
+	static inline u32 index(const Level& level, u32 x, u32 y) {
+		if (L == TextureLayout::ColumnMajor) return level.offset + x * level.height + y;
+		if (L == TextureLayout::Morton) return level.offset + (spreadBits(x) | (spreadBits(y) << 1));
+		return level.offset + y * level.width + x;
+	}
+
+	inline u32 texelIndex(const Level& level, u32 x, u32 y) const {
+		switch (m_layout) {
+			case TextureLayout::ColumnMajor: return index<TextureLayout::ColumnMajor>(level, x, y);
+			case TextureLayout::Morton: return index<TextureLayout::Morton>(level, x, y);
+			default: return index<TextureLayout::RowMajor>(level, x, y);
+		}
+	}
+
+	inline u32 sampleLevel(const Level& level, f32 u, f32 v) const {
+		switch (m_layout) {
+			case TextureLayout::ColumnMajor: return bilinear<TextureLayout::ColumnMajor>(level, u, v);
+			case TextureLayout::Morton: return bilinear<TextureLayout::Morton>(level, u, v);
+			default: return bilinear<TextureLayout::RowMajor>(level, u, v);
+		}
+	}
+
+	// Reorders all levels, which are built row-major
+	void setLayout(TextureLayout layout) {
+		m_layout = layout;
+		if (layout == TextureLayout::RowMajor) return;
+
+		if (layout == TextureLayout::Morton) buildSpread();
+
+		std::vector<u32> texels(m_texels.size());
+		for (const Level& level : m_levels) {
+			for (u32 y = 0; y < level.height; y++) {
+				for (u32 x = 0; x < level.width; x++) {
+					texels[texelIndex(level, x, y)] = m_texels[level.offset + y * level.width + x];
+				}
+			}
+		}
+		m_texels.swap(texels);
+	}
+
+	// Sizes and offsets of the levels down to 1x1, stored after the full-size
+	// texels. Returns the texel count of all levels.
+	u32 buildLevels() {
+		m_levels.assign(1, Level{ m_width, m_height, 0 });
+		u32 count = m_width * m_height;
+		while (m_levels.back().width > 1 || m_levels.back().height > 1) {
+			const Level dst{ std::max(m_levels.back().width / 2, 1u), std::max(m_levels.back().height / 2, 1u), count };
+			count += dst.width * dst.height;
+			m_levels.push_back(dst);
+		}
+		return count;
+	}
+
+	// Box-filters every level from the one above, the full-size texels are row-major
+	void buildMips() {
+		m_texels.resize(buildLevels());
+		for (u32 i = 1; i < m_levels.size(); i++) {
+			const Level& src = m_levels[i - 1];
+			const Level& dst = m_levels[i];
+
+			for (u32 y = 0; y < dst.height; y++) {
+				const u32* row0 = &m_texels[src.offset + (y * 2 % src.height) * src.width];
+				const u32* row1 = &m_texels[src.offset + ((y * 2 + 1) % src.height) * src.width];
+				u32* out = &m_texels[dst.offset + y * dst.width];
+				for (u32 x = 0; x < dst.width; x++) {
+					const u32 x0 = x * 2 % src.width, x1 = (x * 2 + 1) % src.width;
+					out[x] = averageRGB(row0[x0], row0[x1], row1[x0], row1[x1]);
+				}
+			}
+		}
+	}
+
+	void buildSpread() {
+		m_spread.resize(m_width);
+		for (u32 i = 0; i < m_width; i++) m_spread[i] = spreadBits(i);
+	}
+
+	template <TextureLayout L>
+	inline u32 bilinear(const Level& level, f32 u, f32 v) const {
+		const u32 w = level.width, h = level.height;
+		u = u * w;
+		v = v * h;
+
+		const f32 fu = std::floor(u), fv = std::floor(v);
+		const u32 fx = u32((u - fu) * 256.0f), fy = u32((v - fv) * 256.0f);
+
+		i32 x0 = i32(fu) % i32(w), y0 = i32(fv) % i32(h);
+		if (x0 < 0) x0 += w;
+		if (y0 < 0) y0 += h;
+		const u32 x1 = u32(x0) + 1 == w ? 0 : u32(x0) + 1;
+		const u32 y1 = u32(y0) + 1 == h ? 0 : u32(y0) + 1;
+
+		const u32* texels = data();
+		u32 t00, t10, t01, t11;
+		if (L == TextureLayout::Morton) {
+			// Spread once, combine per texel
+			const u32* spread = m_spread.data();
+			const u32 mx0 = spread[x0], mx1 = spread[x1];
+			const u32 my0 = spread[y0] << 1, my1 = spread[y1] << 1;
+			texels += level.offset;
+			t00 = texels[mx0 | my0]; t10 = texels[mx1 | my0];
+			t01 = texels[mx0 | my1]; t11 = texels[mx1 | my1];
+		} else {
+			t00 = texels[index<L>(level, x0, y0)]; t10 = texels[index<L>(level, x1, y0)];
+			t01 = texels[index<L>(level, x0, y1)]; t11 = texels[index<L>(level, x1, y1)];
+		}
+
+#if defined(SIMD_SSE)
+		// Both texels of a row as 8 u16 channels, weighted and summed horizontally,
+		// then the two rows blended vertically. Sums stay below 2^16.
+		const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+		const __m128i wx = _mm_set_epi16(i16(fx), i16(fx), i16(fx), i16(fx), i16(256 - fx), i16(256 - fx), i16(256 - fx), i16(256 - fx));
+		__m128i top = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set_epi32(0, 0, i32(t10), i32(t00)), zero), wx);
+		__m128i bot = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set_epi32(0, 0, i32(t11), i32(t01)), zero), wx);
+		top = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(top, _mm_srli_si128(top, 8)), round), 8);
+		bot = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(bot, _mm_srli_si128(bot, 8)), round), 8);
+
+		__m128i res = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(i16(256 - fy))), _mm_mullo_epi16(bot, _mm_set1_epi16(i16(fy))));
+		res = _mm_srli_epi16(_mm_add_epi16(res, round), 8);
+		return u32(_mm_cvtsi128_si32(_mm_packus_epi16(res, res)));
+#else
+		auto lerp = [](u32 a, u32 b, u32 f) { return (a * (256 - f) + b * f + 128) >> 8; };
+		u32 res = 0;
+		for (u32 shift = 0; shift < 24; shift += 8) {
+			const u32 top = lerp((t00 >> shift) & 0xFF, (t10 >> shift) & 0xFF, fx);
+			const u32 bot = lerp((t01 >> shift) & 0xFF, (t11 >> shift) & 0xFF, fx);
+			res |= lerp(top, bot, fy) << shift;
+		}
+		return res;
+#endif
+	}
+
+	u32 m_width{ 0 }, m_height{ 0 };
+	TextureLayout m_layout{ TextureLayout::RowMajor };
+	std::vector<u32> m_texels; // packed, see pixel.h, all levels
+	const u32* m_view{ nullptr }; // used instead of m_texels when set
+	u32 m_viewCount{ 0 };
+	std::vector<Level> m_levels;
+	std::vector<u32> m_spread; // spreadBits() of every coordinate, Morton only
+	std::vector<u8> m_indices; // palette index of every texel, indexed render mode only
+};
+
+#endif // TEXTURE_H
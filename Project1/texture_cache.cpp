@@ -0,0 +1,186 @@
+#include "texture_cache.h"
+#include "palette.h"
+
+#include <algorithm>
+#include <iostream>
+
+const u32 TextureCache::pending;
+
+TextureCache::TextureCache(u32 loaders)
+	: m_loaders(loaders == 0 ? std::max(1u, std::thread::hardware_concurrency()) : loaders)
+{}
+
+TextureCache::~TextureCache() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+		m_queue.clear();
+	}
+	m_wake.notify_all();
+	for (auto&& thread : m_threads) {
+		thread.join();
+	}
+}
+
+std::string TextureCache::key(const std::string& fileName, TextureLayout layout) {
+	return fileName + "#" + std::to_string(u32(layout));
+}
+
+TextureHandle TextureCache::load(const std::string& fileName, TextureLayout layout) {
+	m_stats.requests++;
+
+	const std::string name = key(fileName, layout);
+	auto it = m_byName.find(name);
+	if (it != m_byName.end()) return it->second;
+
+	Texture texture(fileName, layout);
+	if (texture.empty()) {
+		std::cerr << "Could not load texture: " << fileName << std::endl;
+		m_stats.missing++;
+	}
+
+	const TextureHandle handle = add(std::move(texture));
+	if (m_sources[handle].fileName.empty()) m_sources[handle] = Source{ fileName, layout };
+	m_byName[name] = handle;
+	return handle;
+}
+
+TextureHandle TextureCache::loadAsync(const std::string& fileName, TextureLayout layout) {
+	m_stats.requests++;
+
+	const std::string name = key(fileName, layout);
+	auto it = m_byName.find(name);
+	if (it != m_byName.end()) return it->second;
+
+	const TextureHandle handle = newHandle(fileName, layout);
+	m_byName[name] = handle;
+	m_stats.pending++;
+
+	if (m_threads.empty()) {
+		for (u32 i = 0; i < m_loaders; i++) {
+			m_threads.emplace_back(&TextureCache::loader, this);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.push_back(Job{ handle, fileName, layout, Texture() });
+	}
+	m_wake.notify_one();
+	return handle;
+}
+
+TextureHandle TextureCache::add(Texture&& texture) {
+	const TextureHandle handle = newHandle("", TextureLayout::RowMajor);
+	const TextureHandle owner = place(handle, std::move(texture));
+	if (owner != handle) {
+		m_slots.pop_back();
+		m_sources.pop_back();
+	}
+	return owner;
+}
+
+TextureHandle TextureCache::insert(const std::string& fileName, TextureLayout layout, Texture&& texture) {
+	const TextureHandle handle = newHandle(fileName, layout);
+	quantize(texture);
+	m_stats.textures++;
+	m_stats.bytes += texture.bytes();
+	m_stats.viewBytes += texture.viewBytes();
+	m_slots[handle] = u32(m_textures.size());
+	m_textures.push_back(std::move(texture));
+	m_byName[key(fileName, layout)] = handle;
+	return handle;
+}
+
+void TextureCache::alias(const std::string& fileName, TextureLayout layout, TextureHandle handle) {
+	m_byName[key(fileName, layout)] = handle;
+}
+
+TextureHandle TextureCache::newHandle(const std::string& fileName, TextureLayout layout) {
+	m_slots.push_back(pending);
+	m_sources.push_back(Source{ fileName, layout });
+	return TextureHandle(m_slots.size() - 1);
+}
+
+TextureHandle TextureCache::place(TextureHandle handle, Texture&& texture) {
+	const u64 hash = texture.contentHash();
+	auto range = m_byContent.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (get(it->second).sameTexels(texture)) {
+			m_stats.duplicates++;
+			m_slots[handle] = m_slots[it->second];
+			return it->second;
+		}
+	}
+
+	quantize(texture);
+	m_stats.textures++;
+	m_stats.bytes += texture.bytes();
+	m_stats.viewBytes += texture.viewBytes();
+	m_slots[handle] = u32(m_textures.size());
+	m_textures.push_back(std::move(texture));
+	m_byContent.emplace(hash, handle);
+	return handle;
+}
+
+void TextureCache::setPalette(const Palette* palette) {
+	m_palette = palette;
+	for (Texture& texture : m_textures) {
+		m_stats.bytes -= texture.bytes();
+		if (m_palette) quantize(texture);
+		else texture.setIndices({});
+		m_stats.bytes += texture.bytes();
+	}
+}
+
+void TextureCache::quantize(Texture& texture) const {
+	if (m_palette && !m_palette->empty() && !texture.empty()) texture.setIndices(m_palette->quantize(texture));
+}
+
+u32 TextureCache::publish() {
+	std::vector<Job> done;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_done.empty()) return 0;
+		done.swap(m_done);
+	}
+
+	for (Job& job : done) {
+		if (job.texture.empty()) {
+			std::cerr << "Could not load texture: " << job.fileName << std::endl;
+			m_stats.missing++;
+		}
+		place(job.handle, std::move(job.texture));
+		m_stats.pending--;
+	}
+	return u32(done.size());
+}
+
+void TextureCache::wait() {
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_idle.wait(lock, [this] { return m_queue.empty() && m_busy == 0; });
+	}
+	publish();
+}
+
+void TextureCache::loader() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_wake.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+		if (m_quit) return;
+
+		Job job = std::move(m_queue.front());
+		m_queue.pop_front();
+		m_busy++;
+
+		// Decoding, mips and layout happen outside the lock
+		lock.unlock();
+		job.texture = Texture(job.fileName, job.layout);
+		lock.lock();
+
+		m_done.push_back(std::move(job));
+		m_busy--;
+		if (m_queue.empty() && m_busy == 0) m_idle.notify_all();
+	}
+}
@@ -0,0 +1,116 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "texture.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Palette;
+
+// Index of a texture in a TextureCache
+using TextureHandle = u32;
+const TextureHandle noTexture = 0xFFFFFFFF;
+
+// Owns every texture of the game. Each file/layout pair is loaded once, and
+// textures with identical texels share one handle even when they come from
+// different files. Handles stay valid for the lifetime of the cache.
+// loadAsync() decodes on loader threads; the texture shows up in its handle
+// when the main thread calls publish() between frames, until then the handle
+// samples the empty (magenta) texture.
+class TextureCache {
+public:
+	struct Stats {
+		u32 textures, requests, duplicates, missing, pending;
+		u64 bytes, viewBytes;
+	};
+
+	// File and layout a handle was loaded from, empty for add()
+	struct Source {
+		std::string fileName;
+		TextureLayout layout;
+	};
+
+	// loaders == 0 picks the hardware concurrency, threads start on the first loadAsync()
+	explicit TextureCache(u32 loaders = 2);
+	~TextureCache();
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator =(const TextureCache&) = delete;
+
+	// Blocks while decoding, returns the pending handle if the file is still loading asynchronously
+	TextureHandle load(const std::string& fileName, TextureLayout layout = TextureLayout::RowMajor);
+	TextureHandle loadAsync(const std::string& fileName, TextureLayout layout = TextureLayout::RowMajor);
+	// Takes a texture built elsewhere, returns the handle of an identical one if already cached
+	TextureHandle add(Texture&& texture);
+	// Registers a texture as the result of loading fileName with layout, without
+	// deduplication (for asset packs, which hold every texture once)
+	TextureHandle insert(const std::string& fileName, TextureLayout layout, Texture&& texture);
+	// Makes loading fileName with layout return handle
+	void alias(const std::string& fileName, TextureLayout layout, TextureHandle handle);
+
+	// Quantizes every texture, and every one stored from now on, to the palette
+	// for the indexed render mode (nullptr stops). The palette must outlive the cache.
+	void setPalette(const Palette* palette);
+
+	// Moves the textures decoded since the last call into their handles, returns how many.
+	// Main thread only, while no frame is being drawn.
+	u32 publish();
+	// Waits for every queued load and publishes them
+	void wait();
+
+	// The empty texture (which samples magenta) for noTexture, unknown or pending handles.
+	// References are valid until the next load(), add() or publish().
+	const Texture& get(TextureHandle handle) const {
+		return handle < m_slots.size() && m_slots[handle] != pending ? m_textures[m_slots[handle]] : m_empty;
+	}
+	bool ready(TextureHandle handle) const { return handle < m_slots.size() && m_slots[handle] != pending; }
+
+	const Source& source(TextureHandle handle) const { return m_sources[handle]; }
+	u32 size() const { return u32(m_slots.size()); }
+	const Stats& stats() const { return m_stats; }
+
+private:
+	static const u32 pending = 0xFFFFFFFF;
+
+	struct Job {
+		TextureHandle handle;
+		std::string fileName;
+		TextureLayout layout;
+		Texture texture;
+	};
+
+	static std::string key(const std::string& fileName, TextureLayout layout);
+	TextureHandle newHandle(const std::string& fileName, TextureLayout layout);
+	// Stores texture for handle, or points handle at an identical texture. Returns the handle now owning the texels.
+	TextureHandle place(TextureHandle handle, Texture&& texture);
+	void loader();
+	// Palette indices for a texture about to be stored
+	void quantize(Texture& texture) const;
+
+	std::vector<Texture> m_textures;
+	std::vector<u32> m_slots; // handle -> index in m_textures
+	std::vector<Source> m_sources; // per handle
+	std::unordered_map<std::string, TextureHandle> m_byName;
+	std::unordered_multimap<u64, TextureHandle> m_byContent;
+	Texture m_empty;
+	Stats m_stats{};
+	const Palette* m_palette{ nullptr };
+
+	// Loader threads: m_queue waits for a decoder, m_done for publish()
+	u32 m_loaders;
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_wake, m_idle;
+	std::deque<Job> m_queue;
+	std::vector<Job> m_done;
+	u32 m_busy{ 0 };
+	bool m_quit{ false };
+};
+
+#endif // TEXTURE_CACHE_H
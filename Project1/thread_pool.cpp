@@ -0,0 +1,122 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+static inline u64 packRange(u32 begin, u32 end) {
+	return u64(begin) | (u64(end) << 32);
+}
+
+ThreadPool::ThreadPool(u32 threads) {
+	if (threads == 0) {
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	m_size = threads;
+	m_queues = std::unique_ptr<Queue[]>(new Queue[m_size]);
+
+	for (u32 i = 1; i < m_size; i++) {
+		m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for (auto&& th : m_threads) {
+		th.join();
+	}
+}
+
+void ThreadPool::dispatch(u32 count, u32 grain, Task task, void* ctx) {
+	if (count == 0) return;
+	grain = std::max(grain, 1u);
+
+	const u32 chunks = (count + grain - 1) / grain;
+	if (m_size == 1 || chunks == 1) {
+		task(ctx, 0, count, 0);
+		return;
+	}
+
+	// Contiguous runs of chunks per worker, stealing balances the rest
+	for (u32 w = 0; w < m_size; w++) {
+		u32 begin = u32(u64(chunks) * w / m_size);
+		u32 end = u32(u64(chunks) * (w + 1) / m_size);
+		m_queues[w].range.store(packRange(begin, end), std::memory_order_relaxed);
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_task = task;
+		m_ctx = ctx;
+		m_count = count;
+		m_grain = grain;
+		m_busy = m_size - 1;
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> lk(m_lock);
+	m_done.wait(lk, [this]() { return m_busy == 0; });
+}
+
+bool ThreadPool::popFront(u32 worker, u32& chunk) {
+	std::atomic<u64>& range = m_queues[worker].range;
+	u64 r = range.load(std::memory_order_acquire);
+	while (true) {
+		u32 begin = u32(r), end = u32(r >> 32);
+		if (begin >= end) return false;
+		if (range.compare_exchange_weak(r, packRange(begin + 1, end), std::memory_order_acq_rel)) {
+			chunk = begin;
+			return true;
+		}
+	}
+}
+
+bool ThreadPool::stealBack(u32 worker, u32& chunk) {
+	for (u32 i = 1; i < m_size; i++) {
+		std::atomic<u64>& range = m_queues[(worker + i) % m_size].range;
+		u64 r = range.load(std::memory_order_acquire);
+		while (true) {
+			u32 begin = u32(r), end = u32(r >> 32);
+			if (begin >= end) break;
+			if (range.compare_exchange_weak(r, packRange(begin, end - 1), std::memory_order_acq_rel)) {
+				chunk = end - 1;
+				m_steals.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void ThreadPool::work(u32 worker) {
+	u32 chunk;
+	while (popFront(worker, chunk) || stealBack(worker, chunk)) {
+		u32 begin = chunk * m_grain;
+		u32 end = std::min(begin + m_grain, m_count);
+		m_task(m_ctx, begin, end, worker);
+	}
+}
+
+void ThreadPool::workerLoop(u32 worker) {
+	u64 seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lk(m_lock);
+			m_wake.wait(lk, [&]() { return m_quit || m_generation != seen; });
+			if (m_quit) return;
+			seen = m_generation;
+		}
+
+		work(worker);
+
+		{
+			std::lock_guard<std::mutex> lk(m_lock);
+			if (--m_busy == 0) m_done.notify_one();
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "integer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent worker pool for data-parallel loops. Threads are created once
+// and sleep between jobs; the calling thread always takes part as worker 0.
+// Work is split in chunks of `grain` items, each worker starts on its own
+// contiguous run of chunks and steals from the back of the others when done.
+class ThreadPool {
+public:
+	// threads == 0 picks the hardware concurrency
+	explicit ThreadPool(u32 threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator =(const ThreadPool&) = delete;
+
+	u32 size() const { return m_size; }
+
+	// fn(begin, end, worker) is called for every chunk of [0, count)
+	template <typename Fn>
+	void parallelFor(u32 count, u32 grain, Fn&& fn) {
+		using F = typename std::remove_reference<Fn>::type;
+		dispatch(count, grain, [](void* ctx, u32 begin, u32 end, u32 worker) {
+			(*static_cast<F*>(ctx))(begin, end, worker);
+		}, &fn);
+	}
+
+	u64 steals() const { return m_steals.load(); }
+
+private:
+	using Task = void(*)(void*, u32, u32, u32);
+
+	// Chunk range of one worker, packed as (begin | end << 32) so the owner
+	// (popping the front) and thieves (popping the back) agree through one CAS
+	struct alignas(64) Queue {
+		std::atomic<u64> range{ 0 };
+	};
+
+	void dispatch(u32 count, u32 grain, Task task, void* ctx);
+	void work(u32 worker);
+	bool popFront(u32 worker, u32& chunk);
+	bool stealBack(u32 worker, u32& chunk);
+	void workerLoop(u32 worker);
+
+	u32 m_size{ 1 };
+	std::unique_ptr<Queue[]> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_lock;
+	std::condition_variable m_wake, m_done;
+	u64 m_generation{ 0 };
+	u32 m_busy{ 0 };
+	bool m_quit{ false };
+
+	Task m_task{ nullptr };
+	void* m_ctx{ nullptr };
+	u32 m_count{ 0 }, m_grain{ 1 };
+
+	std::atomic<u64> m_steals{ 0 };
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,71 @@
+#ifndef VEC3_H
+#define VEC3_H
+
+#include "integer.h"
+
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define rad(x) (x * 0.0174533f)
+
+struct Vec3 {
+	f32 x, y, z;
+
+	Vec3(f32 x, f32 y, f32 z) : x(x), y(y), z(z) {}
+	Vec3(f32 angle, f32 z = 0.0f) : x(std::cosf(angle)), y(std::sinf(angle)), z(z) {}
+	Vec3() : x(0.0f), y(0.0f), z(0.0f) {}
+
+	f32 dot(const Vec3& o) const { return x * o.x + y * o.y + z * o.z; }
+
+	Vec3 cross(const Vec3& o) const {
+		return Vec3(y * o.z - z * o.y,  z * o.x - x * o.z,  x * o.y - y * o.x);
+	}
+
+	f32 length() const { return std::sqrtf(dot(*this)); }
+	Vec3 normalized() const { return (*this) / length(); }
+	f32 angleZ() const { return std::atan2f(y, x); }
+
+	Vec3 rotateZ(f32 angle) const {
+		const float s = std::sinf(angle), c = std::cosf(angle);
+		f32 rx = x * c - y * s;
+		f32 ry = x * s + y * c;
+		return Vec3(rx, ry, z);
+	}
+
+	Vec3 lerp(const Vec3& to, f32 fac) const {
+		return (*this) * (1.0f - fac) + to * fac;
+	}
+
+	Vec3 operator +(const Vec3& o) const { return Vec3(x + o.x, y + o.y, z + o.z); }
+	Vec3 operator -(const Vec3& o) const { return Vec3(x - o.x, y - o.y, z - o.z); }
+	Vec3 operator *(const Vec3& o) const { return Vec3(x * o.x, y * o.y, z * o.z); }
+	Vec3 operator *(f32 o) const { return Vec3(x * o, y * o, z * o); }
+	Vec3 operator /(f32 o) const { return Vec3(x / o, y / o, z / o); }
+};
+
+inline bool raySeg(
+	const Vec3& o, const Vec3& d, const Vec3& a, const Vec3& b,
+	Vec3& hit, Vec3& norm, float& t, float& u)
+{
+	Vec3 v1 = o - a;
+	Vec3 v2 = b - a;
+	Vec3 v3 = Vec3(-d.y, d.x, 0.0f);
+
+	f32 d23 = v2.dot(v3);
+	f32 t1 = v2.cross(v1).z / d23;
+	f32 t2 = v1.dot(v3) / d23;
+
+	if (t1 >= 0.0 && t2 >= 0.0 && t2 <= 1.0) {
+		hit = Vec3(a.x + v2.x * t2, a.y + v2.y * t2, 0.0f);
+		norm = Vec3(-v2.y, v2.x);
+		t = t1;
+		u = t2;
+		return true;
+	}
+	return false;
+}
+
+#endif // VEC3_H
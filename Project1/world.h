@@ -0,0 +1,290 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "vec3.h"
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+const f32 blockSize = 8.0f;
+const f32 maxDepth = 60.0f;
+
+struct Object {
+	Vec3 position{ 0.0f, 0.0f, 0.0f };
+	float rotation{ 0.0f };
+
+	// Set when the transform (or a model's geometry) changes, cleared once
+	// derived data like the world lines has been updated.
+	// Code writing position/rotation directly has to set it too.
+	bool dirty{ true };
+
+	inline void moveTo(const Vec3& p) {
+		if (p.x != position.x || p.y != position.y || p.z != position.z) {
+			position = p;
+			dirty = true;
+		}
+	}
+
+	inline void rotateTo(f32 r) {
+		if (r != rotation) {
+			rotation = r;
+			dirty = true;
+		}
+	}
+};
+
+// Rays of up to 8 adjacent screen columns, all starting at origin
+struct RayPacket {
+	static const u32 maxSize = 8;
+
+	Vec3 origin;
+	alignas(16) f32 dx[maxSize], dy[maxSize];
+	u32 size;
+};
+
+struct Viewer : public Object {
+	float fov{ rad(60.0f) };
+};
+
+// Projection tables of the screen, which only depend on its size and the fov
+struct CameraTables {
+	u32 width{ 0 }, height{ 0 };
+	f32 fov{ 0.0f }, tanHalfFov{ 0.0f };
+	// Before rotation, the ray of column x is (1, columnTan[x])
+	std::vector<f32> columnTan;
+	// The floor (below the horizon) or ceiling seen by a row: its distance along
+	// the view direction (0 on the horizon), fog, and mip level of a 1x1 texture
+	std::vector<f32> rowDistance, rowFog, rowLod;
+
+	// Rebuilds the tables if the screen or fov changed, returns whether it did
+	bool update(u32 w, u32 h, f32 viewFov) {
+		if (w == width && h == height && viewFov == fov) return false;
+		width = w;
+		height = h;
+		fov = viewFov;
+		tanHalfFov = ::tanf(fov / 2.0f);
+
+		columnTan.resize(width);
+		for (u32 x = 0; x < width; x++) {
+			columnTan[x] = ((f32(x) / f32(width)) * 2.0f - 1.0f) * tanHalfFov;
+		}
+
+		rowDistance.resize(height);
+		rowFog.resize(height);
+		rowLod.resize(height);
+		const f32 h2 = height / 2;
+		for (u32 y = 0; y < height; y++) {
+			const f32 rows = y < h2 ? (height - y) - h2 : y - h2;
+			rowDistance[y] = rows > 0.0f ? f32(height) / rows / tanHalfFov : 0.0f;
+			rowFog[y] = std::min(std::abs(f32(y) - h2) / maxDepth, 1.0f);
+
+			// A row at screen distance dist spans dist / width texture units across
+			// columns and dist^2 / (2 * height * tan(fov / 2)) along the ray,
+			// the mip level is taken halfway between both (in log2)
+			const f32 dist = f32(height) / std::max(std::abs(f32(y) - h2), 1.0f);
+			const f32 across = dist / f32(width);
+			const f32 along = dist * dist / (2.0f * f32(height) * tanHalfFov);
+			rowLod[y] = 0.5f * (std::log2(across) + std::log2(along));
+		}
+		return true;
+	}
+};
+
+// Ray setup of the screen columns for one frame: the column tables rotated by the viewer
+struct ColumnCamera {
+	// Points closer than this to the viewer plane are clipped when projecting
+	static constexpr f32 nearEpsilon = 1e-4f;
+
+	Vec3 origin, forward, side, plane;
+	u32 width;
+	f32 planeLen2;
+	const f32* columnTan;
+
+	ColumnCamera(const Viewer& viewer, const CameraTables& tables)
+		: origin(viewer.position), width(tables.width), columnTan(tables.columnTan.data())
+	{
+		const f32 c = ::cosf(viewer.rotation), s = ::sinf(viewer.rotation);
+		forward = Vec3(c, s, 0.0f);
+		side = Vec3(-s, c, 0.0f);
+		plane = side * tables.tanHalfFov;
+		planeLen2 = plane.dot(plane);
+	}
+
+	inline Vec3 ray(u32 x) const {
+		return Vec3(forward.x + side.x * columnTan[x], forward.y + side.y * columnTan[x], 0.0f);
+	}
+
+	// Rays of columns [x, x + count), lanes past count repeat the first ray
+	void packet(u32 x, u32 count, RayPacket& p) const {
+		p.origin = origin;
+		p.size = std::min(count, RayPacket::maxSize);
+		for (u32 i = 0; i < RayPacket::maxSize; i++) {
+			const Vec3 d = ray(i < p.size ? x + i : x);
+			p.dx[i] = d.x;
+			p.dy[i] = d.y;
+		}
+	}
+
+	// Screen column of a point (relative to the origin) at depth alpha in front of the viewer
+	inline f32 column(const Vec3& v, f32 alpha) const {
+		const f32 xf = v.dot(plane) / (planeLen2 * alpha);
+		return (xf + 1.0f) * 0.5f * width;
+	}
+
+	// Conservative column range [x0, x1) covered by a segment, clipped to [begin, end)
+	bool columns(const Vec3& a, const Vec3& b, u32 begin, u32 end, u32& x0, u32& x1) const {
+		Vec3 va = a - origin, vb = b - origin;
+		f32 aa = va.dot(forward), ab = vb.dot(forward);
+		if (aa < nearEpsilon && ab < nearEpsilon) return false;
+
+		if (aa < nearEpsilon) {
+			va = va + (vb - va) * ((nearEpsilon - aa) / (ab - aa));
+			aa = nearEpsilon;
+		} else if (ab < nearEpsilon) {
+			vb = vb + (va - vb) * ((nearEpsilon - ab) / (aa - ab));
+			ab = nearEpsilon;
+		}
+
+		f32 ca = column(va, aa), cb = column(vb, ab);
+		f32 lo = std::max(std::floor(std::min(ca, cb)) - 1.0f, f32(begin));
+		f32 hi = std::min(std::ceil(std::max(ca, cb)) + 2.0f, f32(end));
+		if (lo >= hi) return false;
+
+		x0 = u32(lo);
+		x1 = u32(hi);
+		return true;
+	}
+};
+
+// World-space segment (already scaled by blockSize)
+struct Line {
+	Vec3 a, b;
+	f32 u0, u1;
+	TextureHandle texture{ noTexture };
+
+	inline float uv(float t) {
+		return (1.0f - t) * u0 + u1 * t;
+	}
+};
+
+struct HitInfo {
+	Line* line;
+	Vec3 position, normal;
+	f32 distance, u, length;
+};
+
+// Result of a segment query, index refers to the Line that was hit
+struct SegmentHit {
+	u32 index;
+	Vec3 position, normal;
+	f32 t, u;
+};
+
+// Traversal counters of segment queries (nodes/cells visited, segments
+// tested, packet rays that diverged and were finished on their own)
+struct RayStats {
+	u32 nodes{ 0 }, tests{ 0 }, fallbacks{ 0 };
+};
+
+struct Model : public Object {
+	struct Vert {
+		Vec3 pos;
+		f32 u;
+	};
+
+	TextureHandle texture{ noTexture };
+	std::vector<Vert> vertices;
+	std::vector<u32> indices;
+
+	inline void addVert(const Vec3& pos, f32 u) {
+		Vert v;
+		v.pos = pos;
+		v.u = u;
+		vertices.push_back(v);
+		dirty = true;
+	}
+
+	inline void addIndex(u32 i) {
+		indices.push_back(i);
+		dirty = true;
+	}
+
+	inline u32 lineCount() const { return u32(indices.size() / 2); }
+
+	// World-space segment i, rotated about and offset by the model's position
+	inline void line(u32 i, Line& ln) {
+		const Vert& va = vertices[indices[i * 2 + 0]];
+		const Vert& vb = vertices[indices[i * 2 + 1]];
+		Vec3 pa = va.pos, pb = vb.pos;
+		if (rotation != 0.0f) {
+			pa = pa.rotateZ(rotation);
+			pb = pb.rotateZ(rotation);
+		}
+		ln.a = (pa + position) * blockSize;
+		ln.b = (pb + position) * blockSize;
+		ln.u0 = va.u;
+		ln.u1 = vb.u;
+		ln.texture = texture;
+	}
+
+	Model() : Object() {}
+	~Model() = default;
+};
+
+struct Block : public Model {
+	Block(f32 x, f32 y, f32 w, f32 h) : Model() {
+		position.x = x;
+		position.y = y;
+
+		const f32 u1 = w*2.0f;
+		const f32 u2 = h*2.0f;
+		addVert(Vec3(0, 0, 0), 0);
+		addVert(Vec3(w, 0, 0), u1);
+		addVert(Vec3(w, 0, 0), 0);
+		addVert(Vec3(w, h, 0), u2);
+		addVert(Vec3(w, h, 0), 0);
+		addVert(Vec3(0, h, 0), u1);
+		addVert(Vec3(0, h, 0), 0);
+		addVert(Vec3(0, 0, 0), u2);
+
+		addIndex(0);
+		addIndex(1);
+		addIndex(2);
+		addIndex(3);
+		addIndex(4);
+		addIndex(5);
+		addIndex(6);
+		addIndex(7);
+	}
+};
+
+struct Pillar : public Model {
+	Pillar(f32 x, f32 y, f32 radius) : Model() {
+		position.x = x;
+		position.y = y;
+
+		const u32 segments = 12;
+		const f32 step = (M_PI * 2.0f) / segments;
+		const f32 maxu = M_PI * 2.0f * radius;
+		const f32 ustep = maxu / (segments / 2.0f);
+
+		f32 u = 0.0f;
+		for (f32 a = 0.0f; a < M_PI * 2.0f; a += step) {
+			f32 cx = ::cosf(a) * radius;
+			f32 cy = ::sinf(a) * radius;
+			addVert(Vec3(cx + x, cy + y, 0.0f), u);
+			u += ustep;
+		}
+
+		for (u32 i = 0; i < segments-1; i++) {
+			addIndex(i);
+			addIndex(i + 1);
+		}
+		addIndex(0);
+		addIndex(segments - 1);
+	}
+};
+
+#endif // WORLD_H